@@ -0,0 +1,61 @@
+#include "AutGroup.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace Ram
+{
+
+bool AutGroup::isTrivial() const noexcept
+{
+	return generators.empty();
+}
+
+
+bool writeAutGroups(const std::filesystem::path& path, std::span<const AutGroup> groups)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		std::fprintf(stderr, "Cannot write automorphism groups to %s\n", path.c_str());
+		return false;
+	}
+
+	file << "aut " << groups.size() << "\n";
+
+	char size_buf[32];
+	std::string line;
+	for (const auto& group : groups)
+	{
+		std::snprintf(size_buf, sizeof(size_buf), "%.17g", group.grpsize1);
+		file << group.orbits.size() << " " << size_buf << " " << group.grpsize2 << " "
+			<< group.generators.size() << "\n";
+
+		auto writeRow = [&](const std::vector<int>& row) {
+			line.clear();
+			for (auto x : row)
+			{
+				if (!line.empty()) line += ' ';
+				line += std::to_string(x);
+			}
+			line += '\n';
+			file.write(line.data(), line.size());
+		};
+
+		writeRow(group.orbits);
+		for (const auto& gen : group.generators) writeRow(gen);
+	}
+
+	std::printf("Wrote to %s\n\n", path.c_str());
+	return true;
+}
+
+
+std::filesystem::path autPath(const std::filesystem::path& graph_path)
+{
+	auto path = graph_path;
+	return path.replace_extension(".aut");
+}
+
+};	// end of namespace
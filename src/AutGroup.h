@@ -0,0 +1,32 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace Ram
+{
+
+// Automorphisms of a graph that keep every edge color, on the graph's own
+// vertices. Each generator maps v to gen[v], orbits[v] is the smallest vertex
+// in v's orbit, and the group order is grpsize1 * 10^grpsize2.
+struct AutGroup
+{
+	std::vector<std::vector<int>> generators;
+	std::vector<int> orbits;
+	double grpsize1 = 1;
+	int grpsize2 = 0;
+
+	bool isTrivial() const noexcept;
+};
+
+
+// .aut format: "aut count", then per graph a "num_vertices grpsize1 grpsize2
+// num_generators" line, the orbits line and one line per generator. Groups
+// are stored in the order of the graphs in the matching graph file.
+bool writeAutGroups(const std::filesystem::path& path, std::span<const AutGroup> groups);
+
+// Sidecar of a graph file: same path with the .aut extension
+std::filesystem::path autPath(const std::filesystem::path& graph_path);
+
+};	// end of namespace
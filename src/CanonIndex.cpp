@@ -0,0 +1,300 @@
+#include "CanonIndex.h"
+#include "Canonizer.h"
+#include "GraphUtils.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Ram
+{
+
+namespace
+{
+
+constexpr char IndexMagic[8] = { 'R', 'A', 'M', 'C', 'I', 'D', 'X', '2' };
+
+// splitmix64 finalizer
+uint64_t fmix(uint64_t h) noexcept
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebull;
+	h ^= h >> 31;
+	return h;
+}
+
+};	// end of anonymous namespace
+
+
+CanonDigest canonDigest(const std::string& canon) noexcept
+{
+	// Two independently seeded lanes over 8-byte words
+	uint64_t h1 = 0x9e3779b97f4a7c15ull ^ canon.size();
+	uint64_t h2 = 0xc2b2ae3d27d4eb4full + canon.size();
+
+	size_t i = 0;
+	for (; i + 8 <= canon.size(); i += 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, canon.data() + i, 8);
+		h1 = fmix(h1 ^ w);
+		h2 = fmix(h2 + w * 0xff51afd7ed558ccdull);
+	}
+
+	uint64_t tail = 0;
+	std::memcpy(&tail, canon.data() + i, canon.size() - i);
+	h1 = fmix(h1 ^ tail ^ 0x1);
+	h2 = fmix(h2 + tail * 0xff51afd7ed558ccdull + 0x2);
+
+	return { h1, fmix(h1 ^ h2) };
+}
+
+
+CanonIndex::CanonIndex(std::vector<CanonDigest> digests, const CanonSpec& spec) noexcept
+	: owned_keys(std::move(digests))
+	, spec(spec)
+{
+	assert(spec.vertex_cells.empty() && "CanonIndex() Failed: vertex cells cannot be stored.");
+
+	std::sort(owned_keys.begin(), owned_keys.end());
+	owned_keys.erase(std::unique(owned_keys.begin(), owned_keys.end()), owned_keys.end());
+	owned_keys.shrink_to_fit();
+
+	keys = owned_keys.data();
+	num_keys = owned_keys.size();
+	buildFilter();
+}
+
+
+CanonIndex::CanonIndex(CanonIndex&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+
+CanonIndex& CanonIndex::operator=(CanonIndex&& other) noexcept
+{
+	if (this == &other) return *this;
+	release();
+
+	// Moving the vectors keeps their buffers, so the views stay valid
+	owned_filter = std::move(other.owned_filter);
+	owned_keys = std::move(other.owned_keys);
+	mapping = other.mapping;
+	mapping_size = other.mapping_size;
+	filter = other.filter;
+	keys = other.keys;
+	num_blocks = other.num_blocks;
+	num_keys = other.num_keys;
+	spec = std::move(other.spec);
+
+	other.mapping = nullptr;
+	other.mapping_size = 0;
+	other.filter = nullptr;
+	other.keys = nullptr;
+	other.num_blocks = 0;
+	other.num_keys = 0;
+	return *this;
+}
+
+
+CanonIndex::~CanonIndex() noexcept
+{
+	release();
+}
+
+
+CanonIndex CanonIndex::fromGraphs(
+	const std::vector<EdgeColoredUndirectedGraph>& graphs,
+	const CanonSpec& spec,
+	int num_threads) noexcept
+{
+	TaskScheduler scheduler(num_threads);
+	auto keys = canonizeAll(scheduler, graphs, spec);
+
+	std::vector<CanonDigest> digests(graphs.size());
+	for (auto i = 0; i < graphs.size(); ++i)
+	{
+		digests[i] = canonDigest(keys[i]);
+	}
+
+	return CanonIndex(std::move(digests), spec);
+}
+
+
+std::optional<CanonIndex> CanonIndex::open(const std::filesystem::path& path) noexcept
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		std::fprintf(stderr, "Cannot open index %s\n", path.c_str());
+		return std::nullopt;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+	{
+		std::fprintf(stderr, "Index %s is truncated\n", path.c_str());
+		::close(fd);
+		return std::nullopt;
+	}
+
+	void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		std::fprintf(stderr, "Cannot map index %s\n", path.c_str());
+		return std::nullopt;
+	}
+
+	CanonIndex index;
+	index.mapping = mapping;
+	index.mapping_size = st.st_size;
+
+	const auto* header = static_cast<const Header*>(mapping);
+	size_t expected_size = sizeof(Header)
+		+ header->num_blocks * WordsPerBlock * sizeof(uint64_t)
+		+ header->num_keys * sizeof(CanonDigest);
+	if (std::memcmp(header->magic, IndexMagic, sizeof(IndexMagic)) != 0 ||
+		expected_size != index.mapping_size)
+	{
+		std::fprintf(stderr, "Index %s is not a canon index\n", path.c_str());
+		return std::nullopt;
+	}
+
+	index.num_blocks = header->num_blocks;
+	index.num_keys = header->num_keys;
+	index.spec.symmetric_colors = header->symmetric_colors;
+	index.spec.backend = static_cast<CanonBackend>(header->backend);
+	index.filter = reinterpret_cast<const uint64_t*>(header + 1);
+	index.keys = reinterpret_cast<const CanonDigest*>(
+		index.filter + index.num_blocks * WordsPerBlock
+	);
+
+	return index;
+}
+
+
+bool CanonIndex::save(const std::filesystem::path& path) const noexcept
+{
+	if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open())
+	{
+		std::fprintf(stderr, "Cannot write index to %s\n", path.c_str());
+		return false;
+	}
+
+	Header header;
+	std::memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+	header.num_keys = num_keys;
+	header.num_blocks = num_blocks;
+	header.symmetric_colors = spec.symmetric_colors;
+	header.backend = static_cast<int32_t>(spec.backend);
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(
+		reinterpret_cast<const char*>(filter),
+		num_blocks * WordsPerBlock * sizeof(uint64_t)
+	);
+	out.write(reinterpret_cast<const char*>(keys), num_keys * sizeof(CanonDigest));
+	out.flush();
+
+	std::printf("Wrote %zu canonical forms to %s\n", num_keys, path.c_str());
+	return static_cast<bool>(out);
+}
+
+
+bool CanonIndex::contains(const CanonDigest& digest) const noexcept
+{
+	if (!filterContains(digest)) return false;
+	return std::binary_search(keys, keys + num_keys, digest);
+}
+
+
+bool CanonIndex::contains(const std::string& canon) const noexcept
+{
+	return contains(canonDigest(canon));
+}
+
+
+bool CanonIndex::contains(const EdgeColoredUndirectedGraph& g) const noexcept
+{
+	return contains(canonDigest(canonize(g, spec)));
+}
+
+
+size_t CanonIndex::size() const noexcept
+{
+	return num_keys;
+}
+
+
+size_t CanonIndex::memoryBytes() const noexcept
+{
+	return num_blocks * WordsPerBlock * sizeof(uint64_t) + num_keys * sizeof(CanonDigest);
+}
+
+
+const CanonSpec& CanonIndex::canonSpec() const noexcept
+{
+	return spec;
+}
+
+
+void CanonIndex::buildFilter() noexcept
+{
+	num_blocks = std::max<size_t>(1, (num_keys * BitsPerKey + 511) / 512);
+	owned_filter.assign(num_blocks * WordsPerBlock, 0);
+
+	for (auto i = 0; i < num_keys; ++i)
+	{
+		const auto& d = keys[i];
+		auto block = static_cast<size_t>((static_cast<__uint128_t>(d.hi) * num_blocks) >> 64);
+		auto* words = &owned_filter[block * WordsPerBlock];
+		for (auto p = 0; p < NumProbes; ++p)
+		{
+			auto bit = (d.lo >> (p * 9)) & 511;
+			words[bit / 64] |= 1ull << (bit % 64);
+		}
+	}
+
+	filter = owned_filter.data();
+}
+
+
+bool CanonIndex::filterContains(const CanonDigest& d) const noexcept
+{
+	if (num_keys == 0) return false;
+
+	// Digest bits are already uniform: hi picks the block, lo the probes
+	auto block = static_cast<size_t>((static_cast<__uint128_t>(d.hi) * num_blocks) >> 64);
+	const auto* words = filter + block * WordsPerBlock;
+	for (auto p = 0; p < NumProbes; ++p)
+	{
+		auto bit = (d.lo >> (p * 9)) & 511;
+		if (!(words[bit / 64] & (1ull << (bit % 64)))) return false;
+	}
+
+	return true;
+}
+
+
+void CanonIndex::release() noexcept
+{
+	if (mapping) munmap(mapping, mapping_size);
+	mapping = nullptr;
+	mapping_size = 0;
+}
+
+};	// end of namespace
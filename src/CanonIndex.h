@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+#include "GraphUtils.h"
+
+namespace Ram
+{
+
+// Fixed-width 128-bit digest of a canonical string. Distinct canons collide
+// with probability ~2^-64 per pair of graphs, so equal digests are treated
+// as isomorphic.
+struct CanonDigest
+{
+	uint64_t hi;
+	uint64_t lo;
+
+	auto operator<=>(const CanonDigest&) const noexcept = default;
+};
+
+CanonDigest canonDigest(const std::string& canon) noexcept;
+
+
+// Read-only set of canonical forms for finished stages: sorted digests with
+// a blocked Bloom filter in front. A negative lookup touches one cache line
+// of the filter, a positive one adds a binary search over the keys.
+//
+// Indexes are either built in memory or mapped read-only from a file
+// written by save(), which uses the same layout as memory. The header keeps
+// the CanonSpec the keys were made with, and graph lookups canonize with it.
+// Specs with vertex cells depend on the graph and cannot be stored.
+struct CanonIndex
+{
+	CanonIndex() noexcept = default;
+
+	CanonIndex(std::vector<CanonDigest> digests, const CanonSpec& spec = {}) noexcept;
+
+	CanonIndex(CanonIndex&& other) noexcept;
+
+	CanonIndex& operator=(CanonIndex&& other) noexcept;
+
+	CanonIndex(const CanonIndex&) = delete;
+	CanonIndex& operator=(const CanonIndex&) = delete;
+
+	~CanonIndex() noexcept;
+
+	// Canonize graphs (in parallel) and index them
+	static CanonIndex fromGraphs(
+		const std::vector<EdgeColoredUndirectedGraph>& graphs,
+		const CanonSpec& spec = {},
+		int num_threads = 1) noexcept;
+
+	static std::optional<CanonIndex> open(const std::filesystem::path& path) noexcept;
+
+	bool save(const std::filesystem::path& path) const noexcept;
+
+	bool contains(const CanonDigest& digest) const noexcept;
+
+	bool contains(const std::string& canon) const noexcept;
+
+	bool contains(const EdgeColoredUndirectedGraph& g) const noexcept;
+
+	size_t size() const noexcept;
+
+	size_t memoryBytes() const noexcept;
+
+	const CanonSpec& canonSpec() const noexcept;
+
+private:
+	struct Header
+	{
+		char magic[8];
+		uint64_t num_keys;
+		uint64_t num_blocks;
+		int32_t symmetric_colors;
+		int32_t backend;
+	};
+
+	// Filter blocks are one cache line
+	static constexpr size_t WordsPerBlock = 8;
+	static constexpr size_t BitsPerKey = 12;
+	static constexpr size_t NumProbes = 6;
+
+	// Owned storage for built indexes
+	std::vector<uint64_t> owned_filter;
+	std::vector<CanonDigest> owned_keys;
+
+	// Mapped file for opened indexes
+	void* mapping = nullptr;
+	size_t mapping_size = 0;
+
+	const uint64_t* filter = nullptr;
+	const CanonDigest* keys = nullptr;
+	size_t num_blocks = 0;
+	size_t num_keys = 0;
+
+	CanonSpec spec;
+
+	void buildFilter() noexcept;
+
+	bool filterContains(const CanonDigest& digest) const noexcept;
+
+	void release() noexcept;
+};
+
+};	// end of namespace
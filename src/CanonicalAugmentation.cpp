@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <vector>
@@ -5,30 +6,47 @@
 #include <sstream>
 #include <string>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 
+#include "CanonicalAugmentation.h"
+#include "ConcurrentCanonSet.h"
 #include "EdgeColoredUndirectedGraph.h"
+#include "ExternalDedup.h"
 #include "GraphUtils.h"
+#include "LevelStore.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#include "Trace.h"
 
 using namespace Ram;
 
-void processRepresentative(
+namespace
+{
+
+// Call fn(g, c) for every coloring c of the new vertex's edges that adds no
+// monochromatic triangle to representative, where g is the extended graph
+template <typename F>
+void forEachExtension(
 	const Ram::EdgeColoredUndirectedGraph& representative,
 	const std::vector<std::vector<Color>>& colorings,
-	std::vector<Ram::EdgeColoredUndirectedGraph>& new_graphs,
-	std::unordered_set<std::string>& new_canons) noexcept
+	const F& fn) noexcept
 {
 	// Add vertex to rep
 	auto rep_plus_one = representative;
 	rep_plus_one.addVertex();
 
+	// Reassigning one scratch graph reuses its rows across candidates
+	auto g = rep_plus_one;
+
 	// Go through all new edge colors for new vertex
 	for (size_t c = 0; c < colorings.size(); ++c)
 	{
 		const auto& curr_coloring = colorings[c];
 
 		// Apply edge coloring
-		auto g = rep_plus_one;
+		g = rep_plus_one;
 		size_t new_vertex = rep_plus_one.num_vertices - 1;
 		for (auto i = 0; i < new_vertex; ++i)
 		{
@@ -59,6 +77,8 @@ void processRepresentative(
 		// Skip colorings with triangles
 		if (has_tri)
 		{
+			Metrics::add(Metrics::TriangleRejections);
+
 			// Find next coloring that breaks current triangle
 			size_t new_c = c;
 			Color tri_color = curr_coloring[tri_maker_idx];
@@ -72,19 +92,59 @@ void processRepresentative(
 			continue;
 		}
 
+		fn(g, c);
+	}
+}
+
+};	// end of anonymous namespace
+
+
+void processRepresentative(
+	const Ram::EdgeColoredUndirectedGraph& representative,
+	const std::vector<std::vector<Color>>& colorings,
+	std::pmr::vector<Ram::EdgeColoredUndirectedGraph>& new_graphs,
+	Ram::InvariantCanonSet& new_canons,
+	Ram::ExternalDedup* external,
+	Ram::LevelStore* new_level,
+	uint32_t rep_index) noexcept
+{
+	forEachExtension(representative, colorings, [&](const EdgeColoredUndirectedGraph& g, size_t c) {
 		// Track distinct colorings
-		auto canon_str = canonize(g);
-		if (!new_canons.contains(canon_str))
+		if (external)
 		{
-			new_canons.insert(canon_str);
-			new_graphs.push_back(g);
+			external->add(canonize(g), g);
+			return;
 		}
-	}
+
+		auto index = new_level ? new_level->size() : new_graphs.size();
+		if (new_canons.insert(g, index))
+		{
+			if (new_level) new_level->addChild(rep_index, colorings[c]);
+			else new_graphs.push_back(g);
+		}
+	});
 }
 
-void augment(int k_start = 3, int k_stop = 16, Color max_color = 3) noexcept
+std::vector<AugmentLevel> augment(
+	int k_start,
+	int k_stop,
+	Color max_color,
+	const DedupOptions& dedup,
+	const std::filesystem::path& out_dir,
+	bool delta_levels,
+	int num_threads) noexcept
 {
-	std::vector<Ram::EdgeColoredUndirectedGraph> graphs;
+	std::vector<AugmentLevel> levels;
+
+	// Spilled runs hold full graphs, so deltas need in-memory dedup
+	if (delta_levels && dedup.external)
+	{
+		std::printf("External dedup writes full .adj levels, ignoring delta levels\n");
+		delta_levels = false;
+	}
+
+	// Each level lives in its own arena, dropped once the next level is built
+	auto level = std::make_unique<GraphBatch>();
 	if (k_start == 3)
 	{
 		// Get all k2's
@@ -93,14 +153,38 @@ void augment(int k_start = 3, int k_stop = 16, Color max_color = 3) noexcept
 		{
 			auto g = base;
 			g.setEdge(0, 1, static_cast<Color>(c));
-			graphs.push_back(g);
+			level->graphs.push_back(g);
 		}
 	}
-	else
+	else if (!delta_levels)
 	{
 		std::stringstream start_file;
-		start_file << "graphs/k" << k_start-1 << ".adj";
-		graphs = loadBulkAdj(start_file.str());
+		start_file << "k" << k_start-1 << ".adj";
+		for (auto& g : loadBulkAdj(out_dir / start_file.str()))
+		{
+			level->graphs.push_back(std::move(g));
+		}
+	}
+
+	std::filesystem::create_directories(out_dir);
+
+	// Delta levels chain back to a root level of full graphs
+	std::shared_ptr<LevelStore> store;
+	std::filesystem::path store_file;
+	if (delta_levels)
+	{
+		std::stringstream start_file;
+		start_file << "k" << k_start-1;
+		store_file = start_file.str() + ".delta";
+		if (!std::filesystem::exists(out_dir / store_file))
+		{
+			store_file = start_file.str() + ".adj";
+			if (k_start == 3) writeGraphsToFileAdj(out_dir / store_file, level->graphs);
+		}
+
+		store = loadLevel(out_dir / store_file);
+		if (!store) return {};
+		level->graphs.clear();
 	}
 
 
@@ -108,24 +192,137 @@ void augment(int k_start = 3, int k_stop = 16, Color max_color = 3) noexcept
 	for (auto v = k_start; v <= k_stop; ++v)
 	{
 		auto start_time = std::chrono::high_resolution_clock::now();
+		Trace::Span level_span("level", "augment", "k", v);
+		level_span.arg("representatives", store ? store->size() : level->graphs.size());
 
 
 		// Go through all previous canonical representatives
 		auto num_new_edges = v-1;
 		auto colorings = generateAllColorings(num_new_edges, max_color);
 
-		std::vector<Ram::EdgeColoredUndirectedGraph> new_graphs;
-		std::unordered_set<std::string> new_canons;
-		new_graphs.reserve(2700000);
-		new_canons.reserve(2700000);
-		for (const auto& representative : graphs)
+		auto next = std::make_unique<GraphBatch>();
+		auto& new_graphs = next->graphs;
+		std::shared_ptr<LevelStore> next_store;
+		InvariantCanonSet new_canons([&](size_t i) -> const EdgeColoredUndirectedGraph& {
+			return next_store ? next_store->get(i) : new_graphs[i];
+		});
+		std::unique_ptr<ExternalDedup> external;
+		if (dedup.external)
+		{
+			external = std::make_unique<ExternalDedup>(dedup);
+		}
+		else
+		{
+			if (!store) new_graphs.reserve(2700000);
+			if (num_threads == 1) new_canons.reserve(2700000);
+		}
+
+		if (num_threads > 1)
 		{
-			processRepresentative(
-				representative,
-				colorings,
-				new_graphs,
-				new_canons
-			);
+			// Workers share one lock-free set. Kept extensions are tagged with
+			// (representative, coloring) and replayed in sequential loop order.
+			if (store) next_store = std::make_shared<LevelStore>(store);
+			auto num_reps = store ? store->size() : level->graphs.size();
+
+			TaskScheduler scheduler(num_threads);
+			ConcurrentCanonSet shared_canons;
+			PerWorker<std::vector<std::pair<uint32_t, uint32_t>>> kept(scheduler);
+			std::mutex external_lock;
+			parallelFor(scheduler, 0, num_reps, [&](size_t r) {
+				EdgeColoredUndirectedGraph rebuilt(0, max_color);
+				if (store) store->rebuild(r, rebuilt);
+				const auto& representative = store ? rebuilt : level->graphs[r];
+
+				forEachExtension(representative, colorings, [&](const EdgeColoredUndirectedGraph& g, size_t c) {
+					auto canon_str = canonize(g);
+					if (external)
+					{
+						std::lock_guard<std::mutex> lk(external_lock);
+						external->add(canon_str, g);
+						return;
+					}
+
+					Metrics::add(Metrics::DedupInserts);
+					if (shared_canons.insert(canonDigest(canon_str)))
+					{
+						kept.local().emplace_back(r, c);
+					}
+					else
+					{
+						Metrics::add(Metrics::DedupHits);
+					}
+				});
+			});
+
+			std::vector<std::pair<uint32_t, uint32_t>> merged;
+			for (auto& slot : kept.slots)
+			{
+				merged.insert(merged.end(), slot.value.begin(), slot.value.end());
+			}
+			std::sort(merged.begin(), merged.end());
+
+			for (auto [r, c] : merged)
+			{
+				if (next_store)
+				{
+					next_store->addChild(r, colorings[c]);
+					continue;
+				}
+
+				auto g = level->graphs[r];
+				g.addVertex();
+				auto new_vertex = g.num_vertices - 1;
+				for (auto i = 0; i < new_vertex; ++i)
+				{
+					g.setEdge(new_vertex, i, colorings[c][i]);
+				}
+				new_graphs.push_back(g);
+			}
+		}
+		else if (store)
+		{
+			// Children of one representative are rebuilt from its cached graph
+			next_store = std::make_shared<LevelStore>(store);
+			for (size_t r = 0; r < store->size(); ++r)
+			{
+				processRepresentative(
+					store->get(r),
+					colorings,
+					new_graphs,
+					new_canons,
+					nullptr,
+					next_store.get(),
+					r
+				);
+			}
+		}
+		else
+		{
+			for (const auto& representative : level->graphs)
+			{
+				processRepresentative(
+					representative,
+					colorings,
+					new_graphs,
+					new_canons,
+					external.get()
+				);
+			}
+		}
+
+		std::stringstream file_name;
+		file_name << "k" << v << (store ? ".delta" : ".adj");
+		auto file_path = out_dir / file_name.str();
+
+		// Merge spilled runs into the level file, then reload the survivors
+		size_t num_distinct = store ? next_store->size() : new_graphs.size();
+		if (external)
+		{
+			num_distinct = external->finish(file_path);
+			for (auto& g : loadBulkAdj(file_path))
+			{
+				new_graphs.push_back(std::move(g));
+			}
 		}
 
 
@@ -134,20 +331,31 @@ void augment(int k_start = 3, int k_stop = 16, Color max_color = 3) noexcept
 
 		std::printf(
 			"Found %d distinct colorings for k%d in %.2f seconds.\n",
-			static_cast<int>(new_graphs.size()),
+			static_cast<int>(num_distinct),
 			v,
 			time.count()
 		);
+		levels.push_back({ v, num_distinct, time.count() });
 
-		graphs = new_graphs;
+		if (store)
+		{
+			writeLevelDelta(file_path, *next_store, store_file);
+			store = next_store;
+			store_file = file_name.str();
+		}
+		else if (!external)
+		{
+			writeGraphsToFileAdj(file_path, new_graphs);
+		}
 
-		std::stringstream file_path; 
-		file_path << "graphs/k" << v << ".adj";
-		writeGraphsToFileAdj(file_path.str(), graphs);
+		// Releases the previous level's arena in one step
+		level = std::move(next);
 	}
+
+	return levels;
 }
 
-void verify() noexcept
+void verify(const CanonSpec& spec) noexcept
 {
 	for (auto k = 3; k <= 16; ++k)
 	{
@@ -158,7 +366,7 @@ void verify() noexcept
 		std::unordered_set<std::string> canons;
 		for (const auto& g : graphs)
 		{
-			canons.insert(canonize(g));
+			canons.insert(canonize(g, spec));
 		}
 
 		std::printf(
@@ -2,18 +2,47 @@
 
 #include <vector>
 #include <cassert>
+#include <filesystem>
 #include <string>
 #include <unordered_set>
 
 #include "EdgeColoredUndirectedGraph.h"
+#include "ExternalDedup.h"
+#include "GraphUtils.h"
+#include "InvariantCanonSet.h"
+#include "LevelStore.h"
 
 void processRepresentative(
 	const Ram::EdgeColoredUndirectedGraph& representative,
 	const std::vector<std::vector<Ram::Color>>& colorings,
-	std::vector<Ram::EdgeColoredUndirectedGraph>& new_graphs,
-	std::unordered_set<std::string>& new_canons) noexcept;
+	std::pmr::vector<Ram::EdgeColoredUndirectedGraph>& new_graphs,
+	Ram::InvariantCanonSet& new_canons,
+	Ram::ExternalDedup* external = nullptr,
+	Ram::LevelStore* new_level = nullptr,
+	uint32_t rep_index = 0) noexcept;
 
-void augment(int k_start = 3, int k_stop = 16, Ram::Color max_color = 3) noexcept;
+// Distinct colorings found for one k, and the seconds spent finding them
+struct AugmentLevel
+{
+	int k;
+	size_t num_distinct;
+	double seconds;
+};
 
-void verify() noexcept;
+// Writes out_dir/k{k}.adj per level, starting from out_dir/k{k_start-1}.adj.
+// With delta_levels, levels are kept and written as parent deltas (.delta).
+// With several threads, which member of an isomorphism class is kept may
+// vary between runs; the classes and their count do not.
+std::vector<AugmentLevel> augment(
+	int k_start = 3,
+	int k_stop = 16,
+	Ram::Color max_color = 3,
+	const Ram::DedupOptions& dedup = {},
+	const std::filesystem::path& out_dir = "graphs",
+	bool delta_levels = false,
+	int num_threads = 1) noexcept;
+
+// Counts the distinct colorings in graphs/k{3..16}.adj. spec must be the one
+// the levels were deduplicated with; augment uses the plain one.
+void verify(const Ram::CanonSpec& spec = {}) noexcept;
 
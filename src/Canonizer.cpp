@@ -0,0 +1,440 @@
+#include "Canonizer.h"
+#include "Metrics.h"
+
+#include "traces.h"
+
+#include <algorithm>
+#include <charconv>
+#include <numeric>
+
+namespace Ram
+{
+
+namespace
+{
+
+// Nauty reports generators through plain function pointers, so the group
+// being filled is tracked per thread
+thread_local AutGroup* capture_group = nullptr;
+thread_local size_t capture_vertices = 0;
+
+// Cells keep layers apart, so layer 0 maps onto itself and holds the
+// permutation of the original vertices
+void addGenerator(const int* perm) noexcept
+{
+	capture_group->generators.emplace_back(perm, perm + capture_vertices);
+}
+
+void nautyAutomorphism(int, int* perm, int*, int, int, int)
+{
+	addGenerator(perm);
+}
+
+void tracesAutomorphism(int, int* perm, int)
+{
+	addGenerator(perm);
+}
+
+};	// end of anonymous namespace
+
+
+Canonizer::Canonizer() noexcept
+{
+	SG_INIT(canon_sg);
+}
+
+
+Canonizer::~Canonizer() noexcept
+{
+	SG_FREE(canon_sg);
+}
+
+
+Canonizer& Canonizer::local() noexcept
+{
+	static thread_local Canonizer canonizer;
+	return canonizer;
+}
+
+
+std::string Canonizer::canonize(
+	const EdgeColoredUndirectedGraph& g,
+	const CanonSpec& spec,
+	AutGroup* group) noexcept
+{
+	Metrics::ScopedTimer timer(Metrics::CanonizeNanos);
+	Metrics::add(Metrics::CanonizeCalls);
+
+	// Vertex invariants ignore color names, so one partition serves every
+	// color permutation. The backend is also picked once, so all permutations
+	// produce comparable keys.
+	auto partition = initialPartition(g, spec);
+	auto backend = (spec.backend == CanonBackend::Auto) ? chooseBackend(g) : spec.backend;
+	loadColors(g, partition.encoding);
+
+	// Colors past the symmetric ones keep their names
+	int num_symmetric = g.max_color;
+	if (spec.symmetric_colors >= 0) num_symmetric = std::min(spec.symmetric_colors, num_symmetric);
+	std::vector<Color> perm(num_symmetric);
+	std::iota(perm.begin(), perm.end(), 1);
+	color_map.resize(g.max_color + 1);
+	std::iota(color_map.begin(), color_map.end(), 0);
+
+	std::vector<Color> used_symmetric;
+	for (auto c : used_colors)
+	{
+		if (c <= num_symmetric) used_symmetric.push_back(c);
+	}
+
+	auto n = num_vertices * num_layers;
+	best_key.clear();
+	seen_images.clear();
+	do
+	{
+		// Permutations agreeing on the used colors give the same graph
+		auto num_used = used_symmetric.size();
+		for (auto c : used_symmetric) seen_images.push_back(perm[c-1]);
+		bool is_seen = (num_used == 0 && !best_key.empty());
+		for (auto k = 0; num_used > 0 && k + num_used < seen_images.size() && !is_seen; k += num_used)
+		{
+			is_seen = std::equal(
+				seen_images.end() - num_used,
+				seen_images.end(),
+				seen_images.begin() + k
+			);
+		}
+		if (is_seen)
+		{
+			seen_images.resize(seen_images.size() - num_used);
+			continue;
+		}
+
+		// Renaming colors keeps the group, so only the first run collects it
+		std::copy(perm.begin(), perm.end(), color_map.begin() + 1);
+		bool is_first = best_key.empty();
+		run(partition, backend, is_first ? group : nullptr, is_first);
+		writeKey(n, num_words);
+
+		// Only keep lexicographically smallest canonization
+		if (best_key.empty() || key < best_key) std::swap(key, best_key);
+	} while (std::next_permutation(perm.begin(), perm.end()));
+
+	return best_key;
+}
+
+
+AutGroup Canonizer::automorphisms(const EdgeColoredUndirectedGraph& g, const CanonSpec& spec) noexcept
+{
+	auto partition = initialPartition(g, spec);
+	auto backend = (spec.backend == CanonBackend::Auto) ? chooseBackend(g) : spec.backend;
+	loadColors(g, partition.encoding);
+	color_map.resize(g.max_color + 1);
+	std::iota(color_map.begin(), color_map.end(), 0);
+
+	AutGroup group;
+	run(partition, backend, &group, true);
+	return group;
+}
+
+
+std::vector<std::string> Canonizer::canonizeBatch(
+	std::span<const EdgeColoredUndirectedGraph> graphs,
+	const CanonSpec& spec) noexcept
+{
+	std::vector<std::string> keys;
+	keys.reserve(graphs.size());
+	for (const auto& g : graphs)
+	{
+		keys.push_back(canonize(g, spec));
+	}
+
+	return keys;
+}
+
+
+void Canonizer::loadColors(const EdgeColoredUndirectedGraph& g, const NautyEncoding& encoding) noexcept
+{
+	num_vertices = g.num_vertices;
+	num_layers = encoding.num_layers;
+	num_words = SETWORDSNEEDED(num_vertices * num_layers);
+
+	auto colorRow = [&](Color c, size_t l, Vertex v) {
+		return &color_rows[((c * num_layers + l) * num_vertices + v) * num_words];
+	};
+	auto threadRow = [&](size_t l, Vertex v) {
+		return &thread_rows[(l * num_vertices + v) * num_words];
+	};
+
+	colors.assign(num_vertices * num_vertices, 0);
+	color_rows.assign((g.max_color + 1) * num_layers * num_vertices * num_words, 0);
+	thread_rows.assign(num_layers * num_vertices * num_words, 0);
+
+	std::vector<bool> is_used(g.max_color + 1, false);
+	for (auto i = 0; i < num_vertices; ++i)
+	{
+		for (auto j = i+1; j < num_vertices; ++j)
+		{
+			auto c = g.getEdge(i, j);
+			colors[i*num_vertices + j] = colors[j*num_vertices + i] = c;
+			if (c == 0) continue;
+
+			is_used[c] = true;
+			for (auto l = 0; l < num_layers; ++l)
+			{
+				ADDELEMENT(colorRow(c, l, i), l * num_vertices + j);
+				ADDELEMENT(colorRow(c, l, j), l * num_vertices + i);
+			}
+		}
+
+		for (auto l0 = 0; l0 < num_layers; ++l0)
+		{
+			for (auto l1 = 0; l1 < num_layers; ++l1)
+			{
+				if (l0 != l1) ADDELEMENT(threadRow(l0, i), l1 * num_vertices + i);
+			}
+		}
+	}
+
+	used_colors.clear();
+	for (Color c = 1; c <= g.max_color; ++c)
+	{
+		if (is_used[c]) used_colors.push_back(c);
+	}
+}
+
+
+void Canonizer::buildDense(const NautyEncoding& encoding) noexcept
+{
+	size_t n = num_vertices * num_layers;
+	dense_g.resize(n * num_words);
+
+	// Each encoded row is its threads plus the rows of every color whose
+	// permuted code has this layer's bit
+	for (auto l = 0; l < num_layers; ++l)
+	{
+		for (auto i = 0; i < num_vertices; ++i)
+		{
+			auto* row = &dense_g[(l * num_vertices + i) * num_words];
+			const auto* threads = &thread_rows[(l * num_vertices + i) * num_words];
+			std::copy(threads, threads + num_words, row);
+
+			for (auto c : used_colors)
+			{
+				auto code = color_map[c] - encoding.offset;
+				if (!((code >> l) & 0x1)) continue;
+
+				const auto* edges = &color_rows[((c * num_layers + l) * num_vertices + i) * num_words];
+				for (auto w = 0; w < num_words; ++w) row[w] |= edges[w];
+			}
+		}
+	}
+}
+
+
+void Canonizer::buildSparse(const NautyEncoding& encoding, sparsegraph& sg) noexcept
+{
+	size_t n = num_vertices * num_layers;
+
+	// Encoding threads, then one edge per set bit of each color code
+	sparse_d.assign(n, num_layers - 1);
+	for (auto i = 0; i < num_vertices; ++i)
+	{
+		for (auto j = i+1; j < num_vertices; ++j)
+		{
+			auto c = color_map[colors[i*num_vertices + j]] - encoding.offset;
+			for (auto l = 0; l < num_layers; ++l)
+			{
+				if (!((c >> l) & 0x1)) continue;
+				sparse_d[l * num_vertices + i]++;
+				sparse_d[l * num_vertices + j]++;
+			}
+		}
+	}
+
+	sparse_v.assign(n, 0);
+	for (auto i = 1; i < n; ++i) sparse_v[i] = sparse_v[i-1] + sparse_d[i-1];
+	sparse_e.resize(sparse_v[n-1] + sparse_d[n-1]);
+
+	sparse_next = sparse_v;
+	auto add = [&](size_t a, size_t b) {
+		sparse_e[sparse_next[a]++] = b;
+		sparse_e[sparse_next[b]++] = a;
+	};
+	for (auto i = 0; i < num_vertices; ++i)
+	{
+		for (auto l0 = 0; l0 < num_layers; ++l0)
+		{
+			for (auto l1 = l0+1; l1 < num_layers; ++l1)
+			{
+				add(l0 * num_vertices + i, l1 * num_vertices + i);
+			}
+		}
+		for (auto j = i+1; j < num_vertices; ++j)
+		{
+			auto c = color_map[colors[i*num_vertices + j]] - encoding.offset;
+			for (auto l = 0; l < num_layers; ++l)
+			{
+				if ((c >> l) & 0x1) add(l * num_vertices + i, l * num_vertices + j);
+			}
+		}
+	}
+
+	SG_INIT(sg);
+	sg.nv = n;
+	sg.nde = sparse_e.size();
+	sg.v = sparse_v.data();
+	sg.d = sparse_d.data();
+	sg.e = sparse_e.data();
+	sg.vlen = sparse_v.size();
+	sg.dlen = sparse_d.size();
+	sg.elen = sparse_e.size();
+}
+
+
+void Canonizer::run(
+	const NautyPartition& partition,
+	CanonBackend backend,
+	AutGroup* group,
+	bool is_first) noexcept
+{
+	int n = num_vertices * num_layers;
+	int m = num_words;
+	lab = partition.lab;
+	ptn = partition.ptn;
+	orbits.resize(n);
+	canon_g.resize(n*m);
+
+	double grpsize1 = 1;
+	int grpsize2 = 0;
+	if (group)
+	{
+		*group = AutGroup{};
+		capture_group = group;
+		capture_vertices = num_vertices;
+	}
+
+	if (backend == CanonBackend::Dense)
+	{
+		statsblk stats;
+		DEFAULTOPTIONS_GRAPH(options);
+		options.getcanon = true;
+		options.defaultptn = FALSE;
+		if (group) options.userautomproc = nautyAutomorphism;
+
+		buildDense(partition.encoding);
+		densenauty(dense_g.data(), lab.data(), ptn.data(), orbits.data(), &options, &stats, m, n, canon_g.data());
+		Metrics::add(Metrics::NautyNodes, stats.numnodes);
+		grpsize1 = stats.grpsize1;
+		grpsize2 = stats.grpsize2;
+	}
+	else
+	{
+		sparsegraph sg;
+		buildSparse(partition.encoding, sg);
+		if (backend == CanonBackend::Traces)
+		{
+			TracesStats stats;
+			DEFAULTOPTIONS_TRACES(options);
+			options.getcanon = TRUE;
+			options.defaultptn = FALSE;
+			if (group) options.userautomproc = tracesAutomorphism;
+
+			Traces(&sg, lab.data(), ptn.data(), orbits.data(), &options, &stats, &canon_sg);
+			Metrics::add(Metrics::NautyNodes, stats.numnodes);
+			grpsize1 = stats.grpsize1;
+			grpsize2 = stats.grpsize2;
+		}
+		else
+		{
+			statsblk stats;
+			DEFAULTOPTIONS_SPARSEGRAPH(options);
+			options.getcanon = TRUE;
+			options.defaultptn = FALSE;
+			if (group) options.userautomproc = nautyAutomorphism;
+
+			sparsenauty(&sg, lab.data(), ptn.data(), orbits.data(), &options, &stats, &canon_sg);
+			Metrics::add(Metrics::NautyNodes, stats.numnodes);
+			grpsize1 = stats.grpsize1;
+			grpsize2 = stats.grpsize2;
+		}
+
+		// Canonical sparse graph in the dense key layout
+		EMPTYGRAPH(canon_g.data(), m, n);
+		for (auto i = 0; i < n; ++i)
+		{
+			auto* row = GRAPHROW(canon_g.data(), i, m);
+			for (auto k = 0; k < canon_sg.d[i]; ++k)
+			{
+				ADDELEMENT(row, canon_sg.e[canon_sg.v[i] + k]);
+			}
+		}
+	}
+	Metrics::add(Metrics::NautyRuns);
+	if (is_first) Metrics::addGroupSize(grpsize1, grpsize2);
+
+	if (group)
+	{
+		group->orbits.assign(orbits.begin(), orbits.begin() + num_vertices);
+		group->grpsize1 = grpsize1;
+		group->grpsize2 = grpsize2;
+		capture_group = nullptr;
+	}
+}
+
+
+void Canonizer::writeKey(size_t n, size_t m) noexcept
+{
+	// Same layout as getCanonString: every setword in decimal
+	key.clear();
+	char buf[24];
+	for (auto i = 0; i < n*m; ++i)
+	{
+		auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), canon_g[i]);
+		key.append(buf, end);
+	}
+}
+
+
+std::vector<std::string> canonizeAll(
+	TaskScheduler& scheduler,
+	std::span<const EdgeColoredUndirectedGraph> graphs,
+	const CanonSpec& spec) noexcept
+{
+	constexpr size_t BatchSize = 64;
+
+	std::vector<std::string> keys(graphs.size());
+	auto num_batches = (graphs.size() + BatchSize - 1) / BatchSize;
+	parallelFor(scheduler, 0, num_batches, [&](size_t b) {
+		auto begin = b * BatchSize;
+		auto batch = graphs.subspan(begin, std::min(BatchSize, graphs.size() - begin));
+		auto batch_keys = Canonizer::local().canonizeBatch(batch, spec);
+		std::move(batch_keys.begin(), batch_keys.end(), keys.begin() + begin);
+	});
+
+	return keys;
+}
+
+
+std::vector<AutGroup> automorphismGroups(
+	TaskScheduler& scheduler,
+	std::span<const EdgeColoredUndirectedGraph> graphs,
+	const CanonSpec& spec) noexcept
+{
+	std::vector<AutGroup> groups(graphs.size());
+	parallelFor(scheduler, 0, graphs.size(), [&](size_t i) {
+		groups[i] = Canonizer::local().automorphisms(graphs[i], spec);
+	});
+
+	return groups;
+}
+
+bool nautyIsThreadSafe() noexcept
+{
+#ifdef USE_TLS
+	return true;
+#else
+	return false;
+#endif
+}
+
+};	// end of namespace
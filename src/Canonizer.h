@@ -0,0 +1,118 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "AutGroup.h"
+#include "EdgeColoredUndirectedGraph.h"
+#include "GraphUtils.h"
+#include "Scheduler.h"
+#include "nausparse.h"
+
+namespace Ram
+{
+
+// Canonization with reusable workspace. Color permutations are applied while
+// writing the nauty graph instead of through graph copies: every color keeps
+// a bit row per encoded vertex, and a permutation's dense graph is the OR of
+// the rows of colors whose new code sets that layer's bit. Permutations that
+// only differ on colors the graph does not use are skipped.
+//
+// lab/ptn, the nauty graphs and key strings are kept between calls, so a warm
+// Canonizer only allocates the keys it returns. Not safe to share across
+// threads; use local() for the calling thread's instance.
+struct Canonizer
+{
+	Canonizer() noexcept;
+
+	~Canonizer() noexcept;
+
+	Canonizer(const Canonizer&) = delete;
+	Canonizer& operator=(const Canonizer&) = delete;
+
+	// With group set, also stores the automorphisms nauty finds on the way.
+	// They keep every color; color-renaming symmetries are not included.
+	std::string canonize(
+		const EdgeColoredUndirectedGraph& g,
+		const CanonSpec& spec = {},
+		AutGroup* group = nullptr) noexcept;
+
+	// Only the automorphism group, from a single nauty run
+	AutGroup automorphisms(const EdgeColoredUndirectedGraph& g, const CanonSpec& spec = {}) noexcept;
+
+	// Keys in input order; hand each worker its own slice
+	std::vector<std::string> canonizeBatch(
+		std::span<const EdgeColoredUndirectedGraph> graphs,
+		const CanonSpec& spec = {}) noexcept;
+
+	static Canonizer& local() noexcept;
+
+private:
+	// Current graph and color permutation (color_map[c] renames c)
+	size_t num_vertices = 0;
+	std::vector<Color> colors;
+	std::vector<Color> color_map;
+	std::vector<Color> used_colors;
+	std::vector<Color> seen_images;
+
+	// Setword rows of the layered encoding: color c's edges in layer l, and
+	// the threads joining a vertex's layers
+	size_t num_layers = 0;
+	size_t num_words = 0;
+	std::vector<setword> color_rows;
+	std::vector<setword> thread_rows;
+
+	// Nauty input and output
+	std::vector<int> lab;
+	std::vector<int> ptn;
+	std::vector<int> orbits;
+	EdgeColoredUndirectedGraph::NautyGraph dense_g;
+	EdgeColoredUndirectedGraph::NautyGraph canon_g;
+	std::vector<size_t> sparse_v;
+	std::vector<int> sparse_d;
+	std::vector<int> sparse_e;
+	std::vector<size_t> sparse_next;
+	sparsegraph canon_sg;
+
+	std::string key;
+	std::string best_key;
+
+	void loadColors(const EdgeColoredUndirectedGraph& g, const NautyEncoding& encoding) noexcept;
+
+	// Build the permuted graph in dense or sparse form
+	void buildDense(const NautyEncoding& encoding) noexcept;
+	void buildSparse(const NautyEncoding& encoding, sparsegraph& sg) noexcept;
+
+	// Canonical graph of the current permutation into canon_g, optionally
+	// collecting its automorphism group. Renaming colors keeps the group, so
+	// only the first permutation of a graph records its size.
+	void run(
+		const NautyPartition& partition,
+		CanonBackend backend,
+		AutGroup* group,
+		bool is_first) noexcept;
+
+	void writeKey(size_t n, size_t m) noexcept;
+};
+
+
+// Keys in input order, with fixed-size batches canonized by each worker's
+// local Canonizer
+std::vector<std::string> canonizeAll(
+	TaskScheduler& scheduler,
+	std::span<const EdgeColoredUndirectedGraph> graphs,
+	const CanonSpec& spec = {}) noexcept;
+
+// Automorphism group of every graph, in input order
+std::vector<AutGroup> automorphismGroups(
+	TaskScheduler& scheduler,
+	std::span<const EdgeColoredUndirectedGraph> graphs,
+	const CanonSpec& spec = {}) noexcept;
+
+// nauty keeps its workspace in globals unless it was configured with
+// --enable-tls, which defines USE_TLS in nauty.h. Without it, only one
+// thread may canonize at a time.
+bool nautyIsThreadSafe() noexcept;
+
+};	// end of namespace
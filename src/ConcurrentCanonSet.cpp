@@ -0,0 +1,201 @@
+#include "ConcurrentCanonSet.h"
+
+#include <algorithm>
+#include <bit>
+#include <thread>
+
+namespace Ram
+{
+
+ConcurrentCanonSet::Table::Table(size_t capacity) noexcept
+	: capacity(capacity)
+	, slots(new Slot[capacity])
+{ }
+
+
+ConcurrentCanonSet::ConcurrentCanonSet(size_t initial_capacity) noexcept
+{
+	auto capacity = std::bit_ceil(std::max<size_t>(initial_capacity, 2 * MigrateChunk));
+	tables.push_back(std::make_unique<Table>(capacity));
+	head.store(tables.back().get());
+}
+
+
+bool ConcurrentCanonSet::insert(const CanonDigest& digest) noexcept
+{
+	uint64_t hi = digest.hi | KeyBit;
+	uint64_t lo = digest.lo;
+
+	// Skip tables whose migration has finished
+	auto* table = head.load(std::memory_order_acquire);
+	while (table->migrated.load(std::memory_order_acquire) == table->capacity)
+	{
+		auto* next = table->next.load(std::memory_order_acquire);
+		head.compare_exchange_strong(table, next, std::memory_order_acq_rel);
+		table = head.load(std::memory_order_acquire);
+	}
+
+	// Help an ongoing resize along by one chunk
+	if (table->next.load(std::memory_order_acquire)) migrate(*table);
+
+	while (true)
+	{
+		switch (insertInto(*table, hi, lo))
+		{
+			case Result::Inserted:
+				num_keys.fetch_add(1, std::memory_order_relaxed);
+				return true;
+
+			case Result::Present:
+				return false;
+
+			case Result::Moved:
+				table = table->next.load(std::memory_order_acquire);
+				break;
+		}
+	}
+}
+
+
+bool ConcurrentCanonSet::contains(const CanonDigest& digest) const noexcept
+{
+	uint64_t hi = digest.hi | KeyBit;
+	uint64_t lo = digest.lo;
+
+	const auto* table = head.load(std::memory_order_acquire);
+	while (table)
+	{
+		auto mask = table->capacity - 1;
+		bool moved = true;
+		for (size_t probe = 0, i = lo & mask; probe < table->capacity; ++probe, i = (i + 1) & mask)
+		{
+			const auto& slot = table->slots[i];
+			auto h = slot.hi.load(std::memory_order_acquire);
+			while (h == Busy) h = slot.hi.load(std::memory_order_acquire);
+
+			if (h == Empty)
+			{
+				moved = false;
+				break;
+			}
+			if (h == Frozen) break;
+			if (h == hi && slot.lo.load(std::memory_order_relaxed) == lo) return true;
+		}
+
+		if (!moved) return false;
+		table = table->next.load(std::memory_order_acquire);
+	}
+
+	return false;
+}
+
+
+size_t ConcurrentCanonSet::size() const noexcept
+{
+	return num_keys.load(std::memory_order_relaxed);
+}
+
+
+ConcurrentCanonSet::Result ConcurrentCanonSet::insertInto(
+	Table& table,
+	uint64_t hi,
+	uint64_t lo) noexcept
+{
+	auto mask = table.capacity - 1;
+	for (size_t probe = 0, i = lo & mask; probe < table.capacity; ++probe, i = (i + 1) & mask)
+	{
+		auto& slot = table.slots[i];
+		auto h = slot.hi.load(std::memory_order_acquire);
+
+		// Claim an empty slot, then publish lo before the key
+		if (h == Empty)
+		{
+			if (slot.hi.compare_exchange_strong(h, Busy, std::memory_order_acquire))
+			{
+				slot.lo.store(lo, std::memory_order_relaxed);
+				slot.hi.store(hi, std::memory_order_release);
+
+				auto count = table.count.fetch_add(1, std::memory_order_relaxed) + 1;
+				if (count > table.capacity / 2) grow(table);
+				return Result::Inserted;
+			}
+		}
+
+		// Another thread is writing this slot's key
+		while (h == Busy)
+		{
+			std::this_thread::yield();
+			h = slot.hi.load(std::memory_order_acquire);
+		}
+
+		// Keys are only placed before the first empty slot of their probe
+		// sequence, so past a frozen slot the key can only be in the next table
+		if (h == Frozen)
+		{
+			grow(table);
+			return Result::Moved;
+		}
+
+		if (h == hi && slot.lo.load(std::memory_order_relaxed) == lo) return Result::Present;
+	}
+
+	// Every slot holds another key
+	grow(table);
+	return Result::Moved;
+}
+
+
+ConcurrentCanonSet::Table& ConcurrentCanonSet::grow(Table& table) noexcept
+{
+	if (auto* next = table.next.load(std::memory_order_acquire)) return *next;
+
+	std::lock_guard<std::mutex> lk(tables_lock);
+	if (auto* next = table.next.load(std::memory_order_acquire)) return *next;
+
+	tables.push_back(std::make_unique<Table>(table.capacity * 2));
+	auto* next = tables.back().get();
+	table.next.store(next, std::memory_order_release);
+	return *next;
+}
+
+
+void ConcurrentCanonSet::migrate(Table& table) noexcept
+{
+	auto begin = table.migrate_cursor.fetch_add(MigrateChunk, std::memory_order_relaxed);
+	if (begin >= table.capacity) return;
+
+	auto* next = table.next.load(std::memory_order_acquire);
+	auto end = std::min(begin + MigrateChunk, table.capacity);
+	for (auto i = begin; i < end; ++i)
+	{
+		auto& slot = table.slots[i];
+		auto h = slot.hi.load(std::memory_order_acquire);
+		while (true)
+		{
+			// Close empty slots so no key lands here after this pass
+			if (h == Empty && slot.hi.compare_exchange_weak(h, Frozen, std::memory_order_acq_rel)) break;
+			if (h == Busy)
+			{
+				std::this_thread::yield();
+				h = slot.hi.load(std::memory_order_acquire);
+				continue;
+			}
+			if (h == Empty) continue;
+			if (h == Frozen) break;
+
+			// Keys stay readable in place and are copied down the chain
+			auto lo = slot.lo.load(std::memory_order_relaxed);
+			auto* target = next;
+			while (insertInto(*target, h, lo) == Result::Moved)
+			{
+				target = target->next.load(std::memory_order_acquire);
+			}
+			break;
+		}
+	}
+
+	// Once every chunk is done, inserters move head past this table
+	table.migrated.fetch_add(end - begin, std::memory_order_acq_rel);
+}
+
+};	// end of namespace
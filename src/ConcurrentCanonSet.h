@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CanonIndex.h"
+
+namespace Ram
+{
+
+// Insert-only set of canonical digests shared by all workers.
+//
+// Open addressing with linear probing over pairs of 64-bit words. A slot's
+// hi word is its state: EMPTY, BUSY while the claiming thread writes lo,
+// FROZEN once a resize has closed it, or a key (top bit forced to 1 so keys
+// never look like a state). Inserts claim slots with one CAS and never lock.
+//
+// Growing chains a table twice the size behind the current one. Workers keep
+// inserting into the old table while its slots are copied over in chunks;
+// a worker that runs into a frozen slot helps copy the remaining chunks and
+// then moves on to the new table, so no resize stops every thread at once.
+// Retired tables are kept until the set is destroyed.
+struct ConcurrentCanonSet
+{
+	ConcurrentCanonSet(size_t initial_capacity = 1 << 16) noexcept;
+
+	ConcurrentCanonSet(const ConcurrentCanonSet&) = delete;
+	ConcurrentCanonSet& operator=(const ConcurrentCanonSet&) = delete;
+
+	// True iff this call added digest, i.e. the caller is the first inserter
+	// and should keep its graph
+	bool insert(const CanonDigest& digest) noexcept;
+
+	bool contains(const CanonDigest& digest) const noexcept;
+
+	size_t size() const noexcept;
+
+private:
+	static constexpr uint64_t Empty = 0;
+	static constexpr uint64_t Busy = 1;
+	static constexpr uint64_t Frozen = 2;
+	static constexpr uint64_t KeyBit = 1ull << 63;
+	static constexpr size_t MigrateChunk = 1 << 12;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> hi { Empty };
+		std::atomic<uint64_t> lo { 0 };
+	};
+
+	struct Table
+	{
+		size_t capacity;
+		std::unique_ptr<Slot[]> slots;
+		std::atomic<size_t> count { 0 };
+		std::atomic<Table*> next { nullptr };
+		std::atomic<size_t> migrate_cursor { 0 };
+		std::atomic<size_t> migrated { 0 };
+
+		Table(size_t capacity) noexcept;
+	};
+
+	enum class Result
+	{
+		Inserted,
+		Present,
+		Moved
+	};
+
+	std::atomic<Table*> head;
+	std::atomic<size_t> num_keys { 0 };
+
+	std::mutex tables_lock;
+	std::vector<std::unique_ptr<Table>> tables;
+
+	Result insertInto(Table& table, uint64_t hi, uint64_t lo) noexcept;
+
+	Table& grow(Table& table) noexcept;
+
+	// Copy every slot of table into table.next and advance head past it
+	void migrate(Table& table) noexcept;
+};
+
+};	// end of namespace
@@ -5,15 +5,19 @@
 
 namespace Ram {
 
-EdgeColoredUndirectedGraph::EdgeColoredUndirectedGraph(size_t num_vertices, Color max_color) noexcept
-	: num_vertices(num_vertices)
+EdgeColoredUndirectedGraph::EdgeColoredUndirectedGraph(
+	size_t num_vertices,
+	Color max_color,
+	const allocator_type& alloc) noexcept
+	: graph(alloc)
+	, num_vertices(num_vertices)
 	, max_color(max_color)
 {
 	num_layers = numLayersForMaxColor(max_color);
 
-	graph = std::vector<std::vector<uint8_t>>(
+	graph.assign(
 		numEncodedVertices(), 
-		std::vector<uint8_t>(numEncodedVertices(), false)
+		std::pmr::vector<uint8_t>(numEncodedVertices(), false)
 	);
 
 	// Create a clique between vertical threads of color encoding vertices
@@ -24,6 +28,32 @@ EdgeColoredUndirectedGraph::EdgeColoredUndirectedGraph(size_t num_vertices, Colo
 }
 
 
+EdgeColoredUndirectedGraph::EdgeColoredUndirectedGraph(
+	const EdgeColoredUndirectedGraph& other,
+	const allocator_type& alloc) noexcept
+	: graph(other.graph, alloc)
+	, num_vertices(other.num_vertices)
+	, num_layers(other.num_layers)
+	, max_color(other.max_color)
+{ }
+
+
+EdgeColoredUndirectedGraph::EdgeColoredUndirectedGraph(
+	EdgeColoredUndirectedGraph&& other,
+	const allocator_type& alloc) noexcept
+	: graph(std::move(other.graph), alloc)
+	, num_vertices(other.num_vertices)
+	, num_layers(other.num_layers)
+	, max_color(other.max_color)
+{ }
+
+
+EdgeColoredUndirectedGraph::allocator_type EdgeColoredUndirectedGraph::get_allocator() const noexcept
+{
+	return graph.get_allocator();
+}
+
+
 size_t EdgeColoredUndirectedGraph::numEncodedVertices() const noexcept
 {
 	return num_vertices * num_layers;
@@ -50,7 +80,7 @@ void EdgeColoredUndirectedGraph::addVertex() noexcept
 	graph.insert(
 		graph.end(),
 		new_size - old_size,
-		std::vector<uint8_t>(new_size, false)
+		std::pmr::vector<uint8_t>(new_size, false)
 	);
 
 	createEncodingThreads(num_vertices-1);
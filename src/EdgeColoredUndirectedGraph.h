@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
+#include <memory_resource>
 #include <vector>
 #include <cassert>
 #include <string>
@@ -60,13 +61,38 @@ struct EdgeColoredUndirectedGraph
 	// Type to be used when interacting with nauty
 	using NautyGraph = std::vector<setword>;
 
-	std::vector<std::vector<uint8_t>> graph;
+	// Adjacency rows come from this allocator, so a batch of graphs can
+	// share one arena. Plain copies go back to the default heap resource.
+	using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+	std::pmr::vector<std::pmr::vector<uint8_t>> graph;
 	size_t num_vertices;
 	size_t num_layers;
 	Color max_color;
 
 
-	EdgeColoredUndirectedGraph(size_t num_vertices, Color max_color) noexcept;
+	EdgeColoredUndirectedGraph(
+		size_t num_vertices,
+		Color max_color,
+		const allocator_type& alloc = {}) noexcept;
+
+	EdgeColoredUndirectedGraph(const EdgeColoredUndirectedGraph& other) = default;
+
+	EdgeColoredUndirectedGraph(EdgeColoredUndirectedGraph&& other) = default;
+
+	EdgeColoredUndirectedGraph(
+		const EdgeColoredUndirectedGraph& other,
+		const allocator_type& alloc) noexcept;
+
+	EdgeColoredUndirectedGraph(
+		EdgeColoredUndirectedGraph&& other,
+		const allocator_type& alloc) noexcept;
+
+	EdgeColoredUndirectedGraph& operator=(const EdgeColoredUndirectedGraph& other) = default;
+
+	EdgeColoredUndirectedGraph& operator=(EdgeColoredUndirectedGraph&& other) = default;
+
+	allocator_type get_allocator() const noexcept;
 
 	size_t numEncodedVertices() const noexcept;
 
@@ -90,5 +116,14 @@ private:
 	void createEncodingThreads(Vertex v) noexcept;
 };
 
+
+// Graphs of one batch (e.g. an augment level) allocated from a single
+// arena. Destroying the batch releases every graph in one step.
+struct GraphBatch
+{
+	std::pmr::monotonic_buffer_resource arena;
+	std::pmr::vector<EdgeColoredUndirectedGraph> graphs { &arena };
+};
+
 };	// end of namespace
 
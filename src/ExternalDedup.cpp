@@ -0,0 +1,228 @@
+#include "ExternalDedup.h"
+#include "GraphUtils.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <queue>
+#include <sstream>
+#include <unistd.h>
+
+namespace Ram
+{
+
+namespace
+{
+
+void writeRecord(std::ofstream& out, const std::string& key, uint64_t offset)
+{
+	uint32_t len = key.size();
+	out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+	out.write(key.data(), len);
+	out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+}
+
+bool readRecord(std::ifstream& in, std::string& key, uint64_t& offset)
+{
+	uint32_t len;
+	if (!in.read(reinterpret_cast<char*>(&len), sizeof(len))) return false;
+
+	key.resize(len);
+	in.read(key.data(), len);
+	in.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+	return static_cast<bool>(in);
+}
+
+};	// end of anonymous namespace
+
+
+ExternalDedup::ExternalDedup(const DedupOptions& options)
+	: options(options)
+{
+	// Unique work directory so concurrent stages can share a scratch dir
+	static std::atomic<int> instance { 0 };
+	std::stringstream name;
+	name << "dedup-" << getpid() << "-" << instance++;
+
+	work_dir = options.scratch_dir / name.str();
+	std::filesystem::create_directories(work_dir);
+
+	spool.open(work_dir / "spool.adj", std::ios::binary);
+	assert(spool.is_open() && "ExternalDedup() Failed: cannot open spool.");
+}
+
+
+ExternalDedup::~ExternalDedup() noexcept
+{
+	spool.close();
+
+	std::error_code ec;
+	std::filesystem::remove_all(work_dir, ec);
+}
+
+
+void ExternalDedup::add(const std::string& canon, const EdgeColoredUndirectedGraph& g)
+{
+	// Spool graph in .adj format so unique records can be copied verbatim
+	std::string record = g.header_string() + "\n" + g.to_string() + "\n";
+	spool.write(record.data(), record.size());
+	Metrics::add(Metrics::BytesWritten, record.size());
+	Metrics::add(Metrics::DedupInserts);
+
+	buffer.emplace_back(canon, spool_offset);
+	buffer_bytes += canon.size() + sizeof(Offset) + sizeof(std::string);
+	spool_offset += record.size();
+	++num_added;
+
+	if (buffer_bytes >= options.memory_budget) spillRun();
+}
+
+
+size_t ExternalDedup::finish(
+	const std::filesystem::path& out_path,
+	const UniqueCallback& on_unique)
+{
+	spillRun();
+	spool.close();
+
+	auto unique_offsets = mergeRuns();
+	Metrics::add(Metrics::DedupHits, num_added - unique_offsets.size());
+
+	// Copy unique graphs to output in one sequential pass over the spool
+	std::ifstream in(work_dir / "spool.adj", std::ios::binary);
+	std::ofstream out;
+	if (!out_path.empty()) out.open(out_path);
+
+	Offset offset = 0;
+	size_t next_unique = 0;
+	std::string line;
+	std::string record;
+	while (next_unique < unique_offsets.size())
+	{
+		// Read one record, terminated by a blank line
+		record.clear();
+		Offset record_start = offset;
+		while (std::getline(in, line))
+		{
+			offset += line.size() + 1;
+			record += line;
+			record += '\n';
+			if (line.empty()) break;
+		}
+
+		if (record.empty()) break;
+		if (record_start != unique_offsets[next_unique]) continue;
+
+		if (out.is_open()) out.write(record.data(), record.size());
+		++next_unique;
+
+		if (on_unique)
+		{
+			std::stringstream ss(record);
+			for (const auto& g : loadBulkAdj(ss)) on_unique(g);
+		}
+	}
+	std::printf(
+		"Merged %zu runs of %zu graphs into %zu distinct graphs\n",
+		runs.size(),
+		num_added,
+		unique_offsets.size()
+	);
+
+	if (out.is_open())
+	{
+		out.flush();
+		std::printf("Wrote to %s\n\n", out_path.c_str());
+	}
+
+	return unique_offsets.size();
+}
+
+
+size_t ExternalDedup::numAdded() const noexcept
+{
+	return num_added;
+}
+
+
+size_t ExternalDedup::numRuns() const noexcept
+{
+	return runs.size();
+}
+
+
+void ExternalDedup::spillRun()
+{
+	if (buffer.empty()) return;
+
+	// Sort by key, then offset so the first spooled graph wins
+	std::sort(buffer.begin(), buffer.end());
+
+	std::stringstream name;
+	name << "run" << runs.size() << ".bin";
+	auto run_path = work_dir / name.str();
+
+	std::ofstream out(run_path, std::ios::binary);
+	for (auto i = 0; i < buffer.size(); ++i)
+	{
+		if (i > 0 && buffer[i].first == buffer[i-1].first) continue;
+		writeRecord(out, buffer[i].first, buffer[i].second);
+	}
+
+	runs.push_back(run_path);
+	buffer.clear();
+	buffer_bytes = 0;
+}
+
+
+std::vector<ExternalDedup::Offset> ExternalDedup::mergeRuns()
+{
+	struct Cursor
+	{
+		std::string key;
+		Offset offset;
+		size_t run;
+
+		bool operator>(const Cursor& other) const noexcept
+		{
+			if (key != other.key) return key > other.key;
+			return offset > other.offset;
+		}
+	};
+
+	std::vector<std::ifstream> inputs;
+	inputs.reserve(runs.size());
+	std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+	for (auto r = 0; r < runs.size(); ++r)
+	{
+		inputs.emplace_back(runs[r], std::ios::binary);
+
+		Cursor c { {}, 0, static_cast<size_t>(r) };
+		if (readRecord(inputs[r], c.key, c.offset)) heap.push(std::move(c));
+	}
+
+	// Smallest offset of each key arrives first, duplicates follow it
+	std::vector<Offset> unique_offsets;
+	std::string prev_key;
+	bool has_prev = false;
+	while (!heap.empty())
+	{
+		auto c = heap.top();
+		heap.pop();
+
+		if (!has_prev || c.key != prev_key)
+		{
+			unique_offsets.push_back(c.offset);
+			prev_key = c.key;
+			has_prev = true;
+		}
+
+		if (readRecord(inputs[c.run], c.key, c.offset)) heap.push(std::move(c));
+	}
+
+	std::sort(unique_offsets.begin(), unique_offsets.end());
+	return unique_offsets;
+}
+
+};	// end of namespace
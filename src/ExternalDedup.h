@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+
+namespace Ram
+{
+
+struct DedupOptions
+{
+	// Spill canonical keys to disk instead of holding them all in RAM
+	bool external = false;
+
+	// Bytes of canonical keys buffered before a sorted run is spilled
+	size_t memory_budget = size_t(1) << 30;
+
+	// Directory holding the graph spool and sorted runs
+	std::filesystem::path scratch_dir = "graphs/tmp";
+};
+
+
+// Disk-backed replacement for an unordered_set of canonical strings.
+//
+// Every candidate graph is appended to a spool file and its canonical
+// key is buffered with the spool offset. Once the buffer exceeds the
+// memory budget it is sorted, deduplicated and written as a run. finish()
+// k-way merges the runs, keeps the first spooled graph of every key and
+// copies those graphs to the output file in spool order.
+struct ExternalDedup
+{
+	using Offset = uint64_t;
+	using UniqueCallback = std::function<void(const EdgeColoredUndirectedGraph&)>;
+
+	ExternalDedup(const DedupOptions& options);
+
+	~ExternalDedup() noexcept;
+
+	ExternalDedup(const ExternalDedup&) = delete;
+	ExternalDedup& operator=(const ExternalDedup&) = delete;
+
+	// Spool g and record its canonical key
+	void add(const std::string& canon, const EdgeColoredUndirectedGraph& g);
+
+	// Merge all runs and hand one graph per canonical key to on_unique, in
+	// spool order, also writing them to out_path unless it is empty.
+	// Returns the number of distinct graphs.
+	size_t finish(
+		const std::filesystem::path& out_path,
+		const UniqueCallback& on_unique = nullptr);
+
+	size_t numAdded() const noexcept;
+
+	size_t numRuns() const noexcept;
+
+private:
+	DedupOptions options;
+	std::filesystem::path work_dir;
+	std::ofstream spool;
+	Offset spool_offset = 0;
+	size_t num_added = 0;
+
+	std::vector<std::pair<std::string, Offset>> buffer;
+	size_t buffer_bytes = 0;
+	std::vector<std::filesystem::path> runs;
+
+	void spillRun();
+
+	std::vector<Offset> mergeRuns();
+};
+
+};	// end of namespace
@@ -1,10 +1,15 @@
 #include "GraphUtils.h"
+#include "Canonizer.h"
 #include "EdgeColoredUndirectedGraph.h"
+#include "Metrics.h"
 #include "Utils.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 #include <fstream>
+#include <sstream>
 #include <chrono>
 #include <functional>
 #include <numeric>
@@ -33,40 +38,214 @@ std::string getCanonString(graph* cg, int n, int m) noexcept
 }
 
 
+namespace
+{
+
+// Auto backend thresholds. Up to one setword per row dense nauty wins; past
+// that, encodings where few pairs are colored go to the sparse backends.
+constexpr size_t DenseMaxVertices = WORDSIZE;
+constexpr double SparseMaxFill = 0.5;
+constexpr size_t TracesMinVertices = 128;
+
+};	// end of anonymous namespace
+
+
+CanonBackend chooseBackend(const EdgeColoredUndirectedGraph& g) noexcept
+{
+	auto n = g.num_vertices * nautyEncoding(g).num_layers;
+	if (n <= DenseMaxVertices) return CanonBackend::Dense;
+
+	// Share of vertex pairs with a color; unlike the encoded edge count it
+	// does not change when colors are renamed
+	size_t num_colored = 0;
+	for (auto i = 0; i < g.num_vertices; ++i)
+	{
+		for (auto j = i+1; j < g.num_vertices; ++j)
+		{
+			if (g.hasEdge(i, j)) ++num_colored;
+		}
+	}
+	double num_pairs = g.num_vertices * (g.num_vertices - 1) / 2.0;
+	if (num_colored > SparseMaxFill * num_pairs) return CanonBackend::Dense;
+
+	return (n >= TracesMinVertices) ? CanonBackend::Traces : CanonBackend::Sparse;
+}
+
+
 std::string canonize(const EdgeColoredUndirectedGraph& g) noexcept
 {
-	std::string canon_str = "";
-	for (auto& weak_g : getColorPermutations(g))
+	return canonize(g, CanonSpec{});
+}
+
+
+std::string canonize(const EdgeColoredUndirectedGraph& g, const CanonSpec& spec) noexcept
+{
+	return Canonizer::local().canonize(g, spec);
+}
+
+
+namespace
+{
+
+uint64_t mix(uint64_t h, uint64_t x) noexcept
+{
+	// splitmix64 finalizer, stable across platforms and runs
+	h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebull;
+	h ^= h >> 31;
+	return h;
+}
+
+// Shape of the color triple (x, y, z) up to renaming colors: each nonzero
+// color is replaced by the order of its first appearance, 0 stays 0
+int colorPattern(Color x, Color y, Color z) noexcept
+{
+	Color seen[3];
+	int num_seen = 0;
+	int pattern = 0;
+	for (auto c : { x, y, z })
+	{
+		int code = 0;
+		if (c != 0)
+		{
+			code = std::find(seen, seen + num_seen, c) - seen;
+			if (code == num_seen) seen[num_seen++] = c;
+			++code;
+		}
+		pattern = pattern * 4 + code;
+	}
+	return pattern;
+}
+
+};	// end of anonymous namespace
+
+
+std::vector<uint64_t> vertexInvariants(const EdgeColoredUndirectedGraph& g) noexcept
+{
+	auto n = g.num_vertices;
+
+	// Flat color matrix, so the triangle pass avoids layer decoding
+	std::vector<Color> colors(n * n, 0);
+	for (auto i = 0; i < n; ++i)
+	{
+		for (auto j = i+1; j < n; ++j)
+		{
+			colors[i*n + j] = colors[j*n + i] = g.getEdge(i, j);
+		}
+	}
+
+	// Triangles through each vertex by color pattern of (incident, incident,
+	// opposite), with the two incident edges taken in either order
+	constexpr int NumPatterns = 64;
+	std::vector<std::array<uint32_t, NumPatterns>> triangles(n);
+	for (auto& counts : triangles) counts.fill(0);
+	for (auto a = 0; a < n; ++a)
+	{
+		for (auto b = a+1; b < n; ++b)
+		{
+			auto ab = colors[a*n + b];
+			for (auto c = b+1; c < n; ++c)
+			{
+				auto ac = colors[a*n + c];
+				auto bc = colors[b*n + c];
+				triangles[a][std::min(colorPattern(ab, ac, bc), colorPattern(ac, ab, bc))]++;
+				triangles[b][std::min(colorPattern(ab, bc, ac), colorPattern(bc, ab, ac))]++;
+				triangles[c][std::min(colorPattern(ac, bc, ab), colorPattern(bc, ac, ab))]++;
+			}
+		}
+	}
+
+	std::vector<uint64_t> res(n);
+	std::vector<int> deg(g.max_color + 1);
+	for (auto v = 0; v < n; ++v)
+	{
+		// Color degrees, with colored degrees sorted so the invariant does
+		// not depend on which color is which
+		std::fill(deg.begin(), deg.end(), 0);
+		for (auto u = 0; u < n; ++u)
+		{
+			if (u != v) deg[colors[v*n + u]]++;
+		}
+		std::sort(deg.begin() + 1, deg.end());
+
+		uint64_t h = mix(0, deg.size());
+		for (auto d : deg) h = mix(h, d);
+		for (auto t : triangles[v]) h = mix(h, t);
+		res[v] = h;
+	}
+
+	return res;
+}
+
+
+uint64_t invariantHash(const EdgeColoredUndirectedGraph& g) noexcept
+{
+	auto invariants = vertexInvariants(g);
+	std::sort(invariants.begin(), invariants.end());
+
+	uint64_t h = mix(g.num_vertices, g.max_color);
+	for (auto x : invariants) h = mix(h, x);
+	return h;
+}
+
+
+NautyEncoding nautyEncoding(const EdgeColoredUndirectedGraph& g) noexcept
+{
+	for (auto i = 0; i < g.num_vertices; ++i)
 	{
-		// Nauty return data
-		statsblk stats;
-		int n = weak_g.numEncodedVertices();
-		int m = weak_g.numWordsPerVertex();
-		int lab[n], ptn[n], orbits[n];
-		for (auto i = 0; i < n; ++i)
+		for (auto j = i+1; j < g.num_vertices; ++j)
 		{
-			lab[i] = i;
-			ptn[i] = (i+1 < n) ? 1 : 0;
+			if (!g.hasEdge(i, j)) return { g.num_layers, 0 };
 		}
+	}
 
-		// Setup options
-		DEFAULTOPTIONS_GRAPH(options);
-		options.getcanon = true;
+	// Complete coloring, codes 0..max_color-1
+	auto num_layers = std::max<size_t>(1, numBitsInBinary(g.max_color - 1));
+	return { num_layers, 1 };
+}
 
-		// Dense Nauty
-		auto nauty_g = nautify(weak_g);
-		graph canong[n*m];
-		densenauty(nauty_g.data(), lab, ptn, orbits, &options, &stats, m, n, canong);
 
-		// Only keep lexicographically smallest canonization
-		std::string weak_canon_str = getCanonString(canong, n, m);
-		if (canon_str.empty() || weak_canon_str < canon_str)
+NautyPartition initialPartition(
+	const EdgeColoredUndirectedGraph& g,
+	const CanonSpec& spec) noexcept
+{
+	assert((spec.vertex_cells.empty() || spec.vertex_cells.size() == g.num_vertices)
+		&& "Invalid vertex cells for initialPartition()"
+	);
+
+	auto invariants = vertexInvariants(g);
+	auto key = [&](Vertex v) {
+		int cell = spec.vertex_cells.empty() ? 0 : spec.vertex_cells[v];
+		return std::make_pair(cell, invariants[v]);
+	};
+
+	// Vertices ordered by spec cell, then invariant value
+	std::vector<Vertex> order(g.num_vertices);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](Vertex a, Vertex b) {
+		return key(a) < key(b);
+	});
+
+	// Layers get separate cells, so nauty cannot trade one bit of the color
+	// code for another and rename colors the spec keeps fixed
+	NautyPartition partition;
+	partition.encoding = nautyEncoding(g);
+	auto num_layers = partition.encoding.num_layers;
+	for (auto l = 0; l < num_layers; ++l)
+	{
+		for (auto i = 0; i < order.size(); ++i)
 		{
-			canon_str = weak_canon_str;
+			auto v = order[i];
+			bool ends_cell = (i+1 == order.size() || key(order[i+1]) != key(v));
+			partition.lab.push_back(l * g.num_vertices + v);
+			partition.ptn.push_back(ends_cell ? 0 : 1);
 		}
 	}
 
-	return canon_str;
+	return partition;
 }
 
 
@@ -123,8 +302,10 @@ std::vector<std::vector<Color>> generateAllColorings(size_t e, size_t k)
 }
 
 
-bool isTriangleFree(const EdgeColoredUndirectedGraph& g) noexcept
+template <typename Graph>
+bool isTriangleFree(const Graph& g) noexcept
 {
+	Metrics::add(Metrics::TriangleChecks);
 	for (auto i = 0; i < g.num_vertices; ++i)
 	{
 		for (auto j = i+1; j < g.num_vertices; ++j)
@@ -141,6 +322,7 @@ bool isTriangleFree(const EdgeColoredUndirectedGraph& g) noexcept
 
 				if (c0 == c1 && c0 == c2 && c1 == c2) 
 				{
+					Metrics::add(Metrics::TriangleRejections);
 					return false;
 				}
 			}
@@ -151,7 +333,8 @@ bool isTriangleFree(const EdgeColoredUndirectedGraph& g) noexcept
 }
 
 
-bool isPartial(const EdgeColoredUndirectedGraph& g) noexcept
+template <typename Graph>
+bool isPartial(const Graph& g) noexcept
 {
 	for (auto i = 0; i < g.num_vertices; ++i)
 	{
@@ -174,18 +357,41 @@ bool isPartial(const EdgeColoredUndirectedGraph& g) noexcept
 }
 
 
+template <typename Graph>
+bool isFullyColored(const Graph& g) noexcept
+{
+	for (auto i = 0; i < g.num_vertices; ++i)
+	{
+		for (auto j = i+1; j < g.num_vertices; ++j)
+		{
+			if (g.getEdge(i, j) == 0) return false;
+		}
+	}
+
+	return true;
+}
+
+template bool isTriangleFree(const EdgeColoredUndirectedGraph& g) noexcept;
+template bool isTriangleFree(const InducedSubgraphView& g) noexcept;
+template bool isPartial(const EdgeColoredUndirectedGraph& g) noexcept;
+template bool isPartial(const InducedSubgraphView& g) noexcept;
+template bool isFullyColored(const EdgeColoredUndirectedGraph& g) noexcept;
+template bool isFullyColored(const InducedSubgraphView& g) noexcept;
+
+
 std::vector<EdgeColoredUndirectedGraph> getColorPermutations(
 	const EdgeColoredUndirectedGraph& g,
 	int max_color) noexcept
 {
-	if (max_color < 0) max_color = g.max_color;
+	if (max_color < 0 || max_color > g.max_color) max_color = g.max_color;
 	std::vector<Color> colors(max_color, 0);
 	std::iota(colors.begin(), colors.end(), 1);
 
 	std::vector<EdgeColoredUndirectedGraph> res;
 	do
 	{
-		EdgeColoredUndirectedGraph gc(g.num_vertices, max_color);
+		// Colors past max_color stay fixed, so keep the full encoding
+		EdgeColoredUndirectedGraph gc(g.num_vertices, g.max_color);
 		for (auto i = 0; i < g.num_vertices; ++i)
 		{
 			for (auto j = i+1; j < g.num_vertices; ++j)
@@ -211,10 +417,14 @@ std::vector<EdgeColoredUndirectedGraph> getColorPermutations(
 //
 // Embeddability
 //
+template <typename Graph>
 std::vector<Embedding> embed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const EdgeColoredUndirectedGraph& graph) noexcept
 {
+	Metrics::ScopedTimer timer(Metrics::EmbedNanos);
+	Metrics::add(Metrics::EmbedCalls);
+
 	std::vector<Embedding> embeddings;
 
 	// Cannot embed subgraph into smaller graph
@@ -227,24 +437,6 @@ std::vector<Embedding> embed(
 		// Full embedding found
 		if (depth == subgraph.num_vertices)
 		{
-			// Construct overlapping subgraph
-			EdgeColoredUndirectedGraph overlap(graph.num_vertices, subgraph.max_color);
-
-			// Copy vertices of subgraph into overlap
-			for (auto i = 0; i < subgraph.num_vertices; ++i)
-			{
-				// Find corresponding vertex in main graph
-				auto vi_main = map_sub_to_main[i];
-
-				// Copy the edges from vertices in subgraph
-				// as edges from vertices of main graph in overlap
-				for (auto j = i+1; j < subgraph.num_vertices; ++j)
-				{
-					auto vj_main = map_sub_to_main[j];
-					overlap.setEdge(vi_main, vj_main, subgraph.getEdge(i, j));
-				}
-			}
-
 			embeddings.emplace_back(map_sub_to_main);
 			return;
 		}
@@ -286,14 +478,18 @@ std::vector<Embedding> embed(
 	};
 
 	VF2_dfs(0);
+	Metrics::add(Metrics::Embeddings, embeddings.size());
 	return embeddings;
 };
 
 
+template <typename Graph>
 bool canEmbed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const EdgeColoredUndirectedGraph& graph) noexcept
 {
+	Metrics::add(Metrics::CanEmbedCalls);
+
 	// Cannot embed subgraph into smaller graph
 	if (subgraph.num_vertices > graph.num_vertices) return false;
 
@@ -349,8 +545,9 @@ bool canEmbed(
 	return VF2_dfs(0);
 };
 
+template <typename Graph>
 bool canEmbed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const std::vector<EdgeColoredUndirectedGraph>& graphs
 ) noexcept
 {
@@ -365,6 +562,25 @@ bool canEmbed(
 	return false;
 }
 
+template std::vector<Embedding> embed(
+	const EdgeColoredUndirectedGraph& subgraph,
+	const EdgeColoredUndirectedGraph& graph) noexcept;
+template std::vector<Embedding> embed(
+	const InducedSubgraphView& subgraph,
+	const EdgeColoredUndirectedGraph& graph) noexcept;
+template bool canEmbed(
+	const EdgeColoredUndirectedGraph& subgraph,
+	const EdgeColoredUndirectedGraph& graph) noexcept;
+template bool canEmbed(
+	const InducedSubgraphView& subgraph,
+	const EdgeColoredUndirectedGraph& graph) noexcept;
+template bool canEmbed(
+	const EdgeColoredUndirectedGraph& subgraph,
+	const std::vector<EdgeColoredUndirectedGraph>& graphs) noexcept;
+template bool canEmbed(
+	const InducedSubgraphView& subgraph,
+	const std::vector<EdgeColoredUndirectedGraph>& graphs) noexcept;
+
 
 EdgeColoredUndirectedGraph getNeighborhood(
 	const EdgeColoredUndirectedGraph& g,
@@ -423,6 +639,119 @@ EdgeColoredUndirectedGraph getNeighborhood(
 	return neighborhood;
 }
 
+InducedSubgraphView neighborhoodView(
+	const EdgeColoredUndirectedGraph& g,
+	std::vector<Vertex>& neighbors,
+	Vertex v,
+	Color c) noexcept
+{
+	neighbors.clear();
+	for (auto u = 0; u < g.num_vertices; ++u)
+	{
+		if (u == v) continue;
+		if (g.getEdge(u, v) == c)
+		{
+			neighbors.push_back(u);
+		}
+	}
+
+	return InducedSubgraphView(g, neighbors);
+}
+
+//
+// Bitset queries
+//
+ColorMasks::ColorMasks(const EdgeColoredUndirectedGraph& g) noexcept
+	: num_vertices(g.num_vertices)
+	, max_color(g.max_color)
+	, rows((g.max_color + 1) * g.num_vertices, 0)
+{
+	assert(g.num_vertices <= 64 && "ColorMasks() Failed: at most 64 vertices.");
+
+	// Read each encoded row once, assembling colors layer by layer
+	std::vector<Color> colors(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		std::fill(colors.begin(), colors.end(), 0);
+		for (size_t l = 0; l < g.num_layers; ++l)
+		{
+			const auto& row = g.graph[i * g.num_layers + l];
+			for (size_t j = 0; j < num_vertices; ++j)
+			{
+				colors[j] |= row[j * g.num_layers + l] << l;
+			}
+		}
+
+		for (size_t j = 0; j < num_vertices; ++j)
+		{
+			if (j == i) continue;
+			rows[colors[j] * num_vertices + i] |= uint64_t(1) << j;
+		}
+	}
+}
+
+
+std::vector<size_t> ColorMasks::degrees(Color c) const noexcept
+{
+	std::vector<size_t> res(num_vertices);
+	for (size_t v = 0; v < num_vertices; ++v)
+	{
+		res[v] = degree(v, c);
+	}
+
+	return res;
+}
+
+
+bool ColorMasks::isFullyColored(uint64_t set) const noexcept
+{
+	for (auto rest = set; rest; rest &= rest - 1)
+	{
+		if (uncolored(std::countr_zero(rest)) & set) return false;
+	}
+
+	return true;
+}
+
+
+uint64_t colorNeighbors(const EdgeColoredUndirectedGraph& g, Vertex v, Color c) noexcept
+{
+	assert(g.num_vertices <= 64 && "colorNeighbors() Failed: at most 64 vertices.");
+
+	uint64_t res = 0;
+	for (Vertex u = 0; u < g.num_vertices; ++u)
+	{
+		if (u != v && g.getEdge(u, v) == c) res |= uint64_t(1) << u;
+	}
+
+	return res;
+}
+
+
+bool isTriangleFree(const ColorMasks& masks) noexcept
+{
+	Metrics::add(Metrics::TriangleChecks);
+	for (Color c = 1; c <= masks.max_color; ++c)
+	{
+		for (size_t i = 0; i < masks.num_vertices; ++i)
+		{
+			// Neighbors j < k of i sharing color c close a triangle
+			auto later = masks.neighbors(i, c) & ~((uint64_t(2) << i) - 1);
+			for (auto rest = later; rest; rest &= rest - 1)
+			{
+				auto j = std::countr_zero(rest);
+				if (masks.neighbors(j, c) & later)
+				{
+					Metrics::add(Metrics::TriangleRejections);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
 //
 // CNF
 //
@@ -769,13 +1098,21 @@ EdgeColoredUndirectedGraph readMC(const std::string& mc) noexcept
 }
 
 std::vector<EdgeColoredUndirectedGraph> loadBulkMC(std::filesystem::path file_path)
+{
+	std::ifstream file(file_path);
+	assert(file.is_open() && "loadBulkMC() Failed: file not found.");
+
+	return loadBulkMC(file);
+}
+
+std::vector<EdgeColoredUndirectedGraph> loadBulkMC(std::istream& file)
 {
 	std::vector<EdgeColoredUndirectedGraph> graphs;
 
-	std::ifstream file(file_path);
 	std::string line;
 	while (std::getline(file, line))
 	{
+		Metrics::add(Metrics::BytesRead, line.size() + 1);
 		graphs.emplace_back(readMC(line));
 	}
 	
@@ -883,16 +1220,23 @@ std::string getGraphMC(const EdgeColoredUndirectedGraph& g) noexcept
 	return mc;
 }
 
-void writeGraphsToFileMC(
-	const std::filesystem::path& path,
-	const std::vector<EdgeColoredUndirectedGraph>& graphs)
+void writeGraphsMC(std::ostream& out, std::span<const EdgeColoredUndirectedGraph> graphs)
 {
-	std::ofstream out(path);
 	for (const auto& g : graphs)
 	{
-		out << getGraphMC(g) << "\n";
+		auto mc = getGraphMC(g);
+		Metrics::add(Metrics::BytesWritten, mc.size() + 1);
+		out << mc << "\n";
 	}
 	out.flush();
+}
+
+void writeGraphsToFileMC(
+	const std::filesystem::path& path,
+	std::span<const EdgeColoredUndirectedGraph> graphs)
+{
+	std::ofstream out(path);
+	writeGraphsMC(out, graphs);
 
 	std::printf(
 		"Wrote to %s\n\n",
@@ -905,6 +1249,11 @@ std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::filesystem::path file_p
 	std::ifstream file(file_path);
 	assert(file.is_open() && "load_bulk() Failed: file not found.");
 
+	return loadBulkAdj(file);
+}
+
+std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::istream& file)
+{
 	std::vector<EdgeColoredUndirectedGraph> res;
 
 	// Parse File
@@ -913,6 +1262,8 @@ std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::filesystem::path file_p
 
 	while (std::getline(file, line))
 	{
+		Metrics::add(Metrics::BytesRead, line.size() + 1);
+
 		// Parse Header
 		size_t num_vertices;
 		Color max_color;
@@ -931,6 +1282,8 @@ std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::filesystem::path file_p
 		EdgeColoredUndirectedGraph g(num_vertices, max_color);
 		while (std::getline(file, line)) 
 		{
+			Metrics::add(Metrics::BytesRead, line.size() + 1);
+
 			// Read line for this vertex's edge colors
 			ss = std::stringstream(line);
 			size_t j = 0;
@@ -957,17 +1310,25 @@ std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::filesystem::path file_p
 	return res;
 }
 
-void writeGraphsToFileAdj(
-	const std::filesystem::path& path,
-	const std::vector<EdgeColoredUndirectedGraph>& graphs)
+void writeGraphsAdj(std::ostream& out, std::span<const EdgeColoredUndirectedGraph> graphs)
 {
-	std::ofstream out(path);
 	for (const auto& g : graphs)
 	{
-		out << g.header_string() << "\n";
-		out << g.to_string() << "\n";
+		auto header = g.header_string();
+		auto body = g.to_string();
+		Metrics::add(Metrics::BytesWritten, header.size() + body.size() + 2);
+		out << header << "\n";
+		out << body << "\n";
 	}
 	out.flush();
+}
+
+void writeGraphsToFileAdj(
+	const std::filesystem::path& path,
+	std::span<const EdgeColoredUndirectedGraph> graphs)
+{
+	std::ofstream out(path);
+	writeGraphsAdj(out, graphs);
 
 	std::printf(
 		"Wrote to %s\n\n",
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <bit>
+#include <cstdint>
 #include <cstdio>
 #include <ctime>
 #include <vector>
 #include <cassert>
 #include <string>
 #include <filesystem>
+#include <istream>
+#include <ostream>
+#include <span>
 
 #include "cadical.hpp"
 
@@ -19,18 +24,149 @@ bool isIsomorphic(graph* cg1, graph* cg2, int n, int m) noexcept;
 
 std::string getCanonString(graph* cg, int n, int m) noexcept;
 
+// Nauty entry point used by canonize. Every backend returns keys in the
+// dense setword format, but each labels graphs differently, so keys are only
+// comparable when made by the same backend. Auto picks from vertex and edge
+// counts, which isomorphic graphs share.
+enum class CanonBackend
+{
+	Auto,
+	Dense,
+	Sparse,
+	Traces,
+};
+
+CanonBackend chooseBackend(const EdgeColoredUndirectedGraph& g) noexcept;
+
+// What canonize may assume beyond the edges. Colors 1..symmetric_colors may
+// be renamed (every color when negative) and higher colors are kept fixed.
+// Vertices only map onto vertices with the same cell id; cells are ordered
+// by id and an empty vertex_cells puts every vertex in one cell.
+struct CanonSpec
+{
+	int symmetric_colors = -1;
+	std::vector<int> vertex_cells;
+	CanonBackend backend = CanonBackend::Auto;
+};
+
 std::string canonize(const EdgeColoredUndirectedGraph& g) noexcept;
 
+std::string canonize(const EdgeColoredUndirectedGraph& g, const CanonSpec& spec) noexcept;
+
+// Per-vertex hash of color degrees and triangle color patterns. It does not
+// change when colors are renamed, and isomorphisms map it onto itself.
+std::vector<uint64_t> vertexInvariants(const EdgeColoredUndirectedGraph& g) noexcept;
+
+// Sorted vertex invariants hashed into one word; isomorphic graphs agree
+uint64_t invariantHash(const EdgeColoredUndirectedGraph& g) noexcept;
+
+// Layout of the graph handed to nauty: num_layers encoded vertices per
+// vertex, and edge color c written as the bits of c - offset. Complete
+// colorings never use the "no edge" code 0, so they shift colors down by
+// one and may drop a layer (2 instead of 3 for 4 colors).
+struct NautyEncoding
+{
+	size_t num_layers;
+	Color offset;
+};
+
+NautyEncoding nautyEncoding(const EdgeColoredUndirectedGraph& g) noexcept;
+
+// Initial nauty partition over encoded vertices (lab/ptn)
+struct NautyPartition
+{
+	NautyEncoding encoding;
+	std::vector<int> lab;
+	std::vector<int> ptn;
+};
+
+// Picks the encoding, then one block of cells per encoding layer, each split
+// by spec cell and then by vertex invariant. Encoded vertices are numbered
+// layer-major: layer l of vertex v is l * num_vertices + v.
+NautyPartition initialPartition(
+	const EdgeColoredUndirectedGraph& g,
+	const CanonSpec& spec = {}) noexcept;
+
 EdgeColoredUndirectedGraph::NautyGraph 
 nautify(const EdgeColoredUndirectedGraph& g) noexcept;
 
 
+// Views
+// Induced subgraph read through its host: view vertex i is vertices[i] of
+// graph. Nothing is copied, so the host and the vertex list must outlive
+// the view and the view sees later edits to the host.
+struct InducedSubgraphView
+{
+	const EdgeColoredUndirectedGraph* graph;
+	std::span<const Vertex> vertices;
+	size_t num_vertices;
+	Color max_color;
+
+	InducedSubgraphView(const EdgeColoredUndirectedGraph& graph, std::span<const Vertex> vertices) noexcept
+		: graph(&graph)
+		, vertices(vertices)
+		, num_vertices(vertices.size())
+		, max_color(graph.max_color)
+	{}
+
+	Color getEdge(Vertex i, Vertex j) const noexcept { return graph->getEdge(vertices[i], vertices[j]); }
+
+	bool hasEdge(Vertex i, Vertex j) const noexcept { return graph->hasEdge(vertices[i], vertices[j]); }
+};
+
+// Color c neighborhood of v as a view. neighbors is cleared and refilled
+// with the host vertices, so reusing one buffer keeps queries allocation free.
+InducedSubgraphView neighborhoodView(
+	const EdgeColoredUndirectedGraph& g,
+	std::vector<Vertex>& neighbors,
+	Vertex v,
+	Color c) noexcept;
+
+
+// Bitset queries
+// Per-color neighbor sets of a graph on at most 64 vertices, as bitmasks.
+// Building reads the adjacency matrix once; queries after that are ANDs and
+// popcounts. Color 0 holds the uncolored pairs, never v itself.
+struct ColorMasks
+{
+	size_t num_vertices;
+	Color max_color;
+	std::vector<uint64_t> rows;
+
+	explicit ColorMasks(const EdgeColoredUndirectedGraph& g) noexcept;
+
+	uint64_t neighbors(Vertex v, Color c) const noexcept { return rows[c * num_vertices + v]; }
+
+	uint64_t uncolored(Vertex v) const noexcept { return neighbors(v, 0); }
+
+	size_t degree(Vertex v, Color c) const noexcept { return std::popcount(neighbors(v, c)); }
+
+	// Color c degree of every vertex
+	std::vector<size_t> degrees(Color c) const noexcept;
+
+	// Every pair of vertices inside set has an edge color
+	bool isFullyColored(uint64_t set) const noexcept;
+};
+
+// Color c neighbors of v, read from one row without building ColorMasks
+uint64_t colorNeighbors(const EdgeColoredUndirectedGraph& g, Vertex v, Color c) noexcept;
+
+bool isTriangleFree(const ColorMasks& masks) noexcept;
+
+
 // Coloring
+// Graph queries below take EdgeColoredUndirectedGraph or InducedSubgraphView
 std::vector<std::vector<Color>> generateAllColorings(size_t e, size_t k);
 
-bool isTriangleFree(const EdgeColoredUndirectedGraph& g) noexcept;
+template <typename Graph>
+bool isTriangleFree(const Graph& g) noexcept;
+
+template <typename Graph>
+bool isPartial(const Graph& g) noexcept;
 
-bool isPartial(const EdgeColoredUndirectedGraph& g) noexcept;
+// Every pair of vertices has an edge color
+template <typename Graph>
+bool isFullyColored(const Graph& g) noexcept;
 
 std::vector<EdgeColoredUndirectedGraph> 
 getColorPermutations(const EdgeColoredUndirectedGraph& g, int max_color = -1) noexcept;
@@ -39,16 +175,19 @@ getColorPermutations(const EdgeColoredUndirectedGraph& g, int max_color = -1) no
 // Embeddability
 using Embedding = std::vector<int>;
 
+template <typename Graph>
 std::vector<Embedding> embed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const EdgeColoredUndirectedGraph& graph) noexcept;
 
+template <typename Graph>
 bool canEmbed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const EdgeColoredUndirectedGraph& graph) noexcept;
 
+template <typename Graph>
 bool canEmbed(
-	const EdgeColoredUndirectedGraph& subgraph,
+	const Graph& subgraph,
 	const std::vector<EdgeColoredUndirectedGraph>& graphs
 ) noexcept;
 
@@ -77,17 +216,29 @@ std::unique_ptr<CaDiCaL::Solver> getCNFSolver(
 // IO
 void writeCNFToFile(std::filesystem::path file_path, const CNF& cnf);
 
+EdgeColoredUndirectedGraph readMC(const std::string& mc) noexcept;
+
+std::string getGraphMC(const EdgeColoredUndirectedGraph& g) noexcept;
+
 std::vector<EdgeColoredUndirectedGraph> loadBulkMC(std::filesystem::path file_path);
 
+std::vector<EdgeColoredUndirectedGraph> loadBulkMC(std::istream& file);
+
+void writeGraphsMC(std::ostream& out, std::span<const EdgeColoredUndirectedGraph> graphs);
+
 void writeGraphsToFileMC(
 	const std::filesystem::path& path,
-	const std::vector<EdgeColoredUndirectedGraph>& graphs);
+	std::span<const EdgeColoredUndirectedGraph> graphs);
 
 std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::filesystem::path file_path);
 
+std::vector<EdgeColoredUndirectedGraph> loadBulkAdj(std::istream& file);
+
+void writeGraphsAdj(std::ostream& out, std::span<const EdgeColoredUndirectedGraph> graphs);
+
 void writeGraphsToFileAdj(
 	const std::filesystem::path& path,
-	const std::vector<EdgeColoredUndirectedGraph>& graphs);
+	std::span<const EdgeColoredUndirectedGraph> graphs);
 
 };	// end of namespace
 
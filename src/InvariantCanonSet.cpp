@@ -0,0 +1,66 @@
+#include "InvariantCanonSet.h"
+#include "GraphUtils.h"
+#include "Metrics.h"
+
+#include <algorithm>
+
+namespace Ram
+{
+
+InvariantCanonSet::InvariantCanonSet(Lookup lookup, Canon canon_of) noexcept
+	: lookup(std::move(lookup))
+	, canon_of(std::move(canon_of))
+{
+	if (!this->canon_of)
+	{
+		this->canon_of = [](const EdgeColoredUndirectedGraph& g) { return canonize(g); };
+	}
+}
+
+
+bool InvariantCanonSet::insert(const EdgeColoredUndirectedGraph& g, size_t index) noexcept
+{
+	Metrics::add(Metrics::DedupInserts);
+
+	auto [it, is_new] = buckets.try_emplace(invariantHash(g));
+	auto& bucket = it->second;
+	if (is_new)
+	{
+		Metrics::add(Metrics::CanonizeSkips);
+		bucket.pending = index;
+		++num_graphs;
+		return true;
+	}
+
+	// Collision, canonize the bucket's first graph now
+	if (bucket.pending != NoPending)
+	{
+		bucket.canons.push_back(canon_of(lookup(bucket.pending)));
+		bucket.pending = NoPending;
+	}
+
+	auto canon = canon_of(g);
+	if (std::find(bucket.canons.begin(), bucket.canons.end(), canon) != bucket.canons.end())
+	{
+		Metrics::add(Metrics::DedupHits);
+		return false;
+	}
+
+	bucket.canons.push_back(std::move(canon));
+	++num_graphs;
+	return true;
+}
+
+
+size_t InvariantCanonSet::size() const noexcept
+{
+	return num_graphs;
+}
+
+
+void InvariantCanonSet::reserve(size_t n) noexcept
+{
+	buckets.reserve(n);
+}
+
+};	// end of namespace
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+
+namespace Ram
+{
+
+// Two-level canonical dedup. Graphs are bucketed by invariantHash and only
+// canonized once a second graph lands in their bucket, so graphs that the
+// invariant already tells apart never reach nauty.
+//
+// The set does not own graphs: the caller stores every accepted graph and
+// lookup(index) must return it when its bucket later collides. canon_of
+// replaces canonize for graphs with a CanonSpec; graphs it maps to the same
+// form must also agree on invariantHash.
+struct InvariantCanonSet
+{
+	using Lookup = std::function<const EdgeColoredUndirectedGraph&(size_t)>;
+	using Canon = std::function<std::string(const EdgeColoredUndirectedGraph&)>;
+
+	InvariantCanonSet(Lookup lookup, Canon canon_of = {}) noexcept;
+
+	// True if g is isomorphic to no graph inserted so far. The caller must
+	// then store g so that lookup(index) returns it.
+	bool insert(const EdgeColoredUndirectedGraph& g, size_t index) noexcept;
+
+	size_t size() const noexcept;
+
+	void reserve(size_t n) noexcept;
+
+private:
+	static constexpr size_t NoPending = SIZE_MAX;
+
+	struct Bucket
+	{
+		// Index of the bucket's only graph while it is still uncanonized
+		size_t pending = NoPending;
+		std::vector<std::string> canons;
+	};
+
+	Lookup lookup;
+	Canon canon_of;
+	std::unordered_map<uint64_t, Bucket> buckets;
+	size_t num_graphs = 0;
+};
+
+};	// end of namespace
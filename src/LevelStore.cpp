@@ -0,0 +1,223 @@
+#include "LevelStore.h"
+#include "GraphUtils.h"
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace Ram
+{
+
+LevelStore::LevelStore(std::vector<EdgeColoredUndirectedGraph> roots) noexcept
+	: num_vertices(roots.empty() ? 0 : roots[0].num_vertices)
+	, max_color(roots.empty() ? 0 : roots[0].max_color)
+	, graphs(std::move(roots))
+	, cache(0, max_color)
+{ }
+
+
+LevelStore::LevelStore(std::shared_ptr<const LevelStore> parent) noexcept
+	: parent(std::move(parent))
+	, num_vertices(this->parent->num_vertices + 1)
+	, max_color(this->parent->max_color)
+	, cache(0, max_color)
+{ }
+
+
+bool LevelStore::isRoot() const noexcept
+{
+	return parent == nullptr;
+}
+
+
+size_t LevelStore::size() const noexcept
+{
+	return isRoot() ? graphs.size() : parent_indices.size();
+}
+
+
+void LevelStore::addChild(uint32_t parent_index, const std::vector<Color>& coloring) noexcept
+{
+	assert(!isRoot() && coloring.size() == num_vertices-1
+		&& "Invalid child for LevelStore::addChild()"
+	);
+
+	parent_indices.push_back(parent_index);
+	colorings.insert(colorings.end(), coloring.begin(), coloring.end());
+}
+
+
+const EdgeColoredUndirectedGraph& LevelStore::get(size_t i) const noexcept
+{
+	assert(i < size() && "Invalid index for LevelStore::get()");
+	if (isRoot()) return graphs[i];
+	if (cache_index == i) return cache;
+
+	cache = parent->get(parent_indices[i]);
+	extend(i, cache);
+
+	cache_index = i;
+	return cache;
+}
+
+
+void LevelStore::rebuild(size_t i, EdgeColoredUndirectedGraph& out) const noexcept
+{
+	assert(i < size() && "Invalid index for LevelStore::rebuild()");
+	if (isRoot())
+	{
+		out = graphs[i];
+		return;
+	}
+
+	parent->rebuild(parent_indices[i], out);
+	extend(i, out);
+}
+
+
+void LevelStore::extend(size_t i, EdgeColoredUndirectedGraph& g) const noexcept
+{
+	// Parent plus the new vertex's colored edges
+	g.addVertex();
+
+	auto new_vertex = num_vertices - 1;
+	const auto* coloring = &colorings[i * new_vertex];
+	for (auto v = 0; v < new_vertex; ++v)
+	{
+		g.setEdge(new_vertex, v, coloring[v]);
+	}
+}
+
+
+std::vector<EdgeColoredUndirectedGraph> LevelStore::materialize() const noexcept
+{
+	std::vector<EdgeColoredUndirectedGraph> res;
+	res.reserve(size());
+	for (auto i = 0; i < size(); ++i)
+	{
+		res.push_back(get(i));
+	}
+
+	return res;
+}
+
+
+bool writeLevelDelta(
+	const std::filesystem::path& path,
+	const LevelStore& level,
+	const std::filesystem::path& parent_file)
+{
+	assert(!level.isRoot() && "writeLevelDelta() Failed: root levels are written as .adj.");
+
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		std::fprintf(stderr, "Cannot write level to %s\n", path.c_str());
+		return false;
+	}
+
+	file << "delta " << parent_file.string() << "\n";
+	file << level.num_vertices << " " << static_cast<int>(level.max_color) << " " << level.size() << "\n";
+
+	auto num_colors = level.num_vertices - 1;
+	std::string line;
+	for (auto i = 0; i < level.size(); ++i)
+	{
+		line = std::to_string(level.parent_indices[i]);
+		line += ' ';
+		for (auto v = 0; v < num_colors; ++v)
+		{
+			line += static_cast<char>('0' + level.colorings[i * num_colors + v]);
+		}
+		line += '\n';
+		file.write(line.data(), line.size());
+	}
+
+	std::printf("Wrote to %s\n\n", path.c_str());
+	return true;
+}
+
+
+std::shared_ptr<LevelStore> loadLevel(const std::filesystem::path& path)
+{
+	if (!std::filesystem::exists(path))
+	{
+		std::fprintf(stderr, "Cannot read level %s\n", path.c_str());
+		return nullptr;
+	}
+
+	if (path.extension() != ".delta")
+	{
+		return std::make_shared<LevelStore>(loadBulkAdj(path));
+	}
+
+	std::ifstream file(path);
+	std::string tag;
+	std::string parent_file;
+	if (!(file >> tag >> parent_file) || tag != "delta")
+	{
+		std::fprintf(stderr, "Level %s has no delta header\n", path.c_str());
+		return nullptr;
+	}
+
+	auto parent = loadLevel(path.parent_path() / parent_file);
+	if (!parent) return nullptr;
+	auto level = std::make_shared<LevelStore>(parent);
+
+	size_t num_vertices;
+	int max_color;
+	size_t count;
+	if (!(file >> num_vertices >> max_color >> count) ||
+		num_vertices != level->num_vertices ||
+		max_color != level->max_color)
+	{
+		std::fprintf(stderr, "Level %s does not extend %s\n", path.c_str(), parent_file.c_str());
+		return nullptr;
+	}
+
+	std::vector<Color> coloring(num_vertices - 1);
+	uint32_t parent_index;
+	std::string digits;
+	level->parent_indices.reserve(count);
+	level->colorings.reserve(count * coloring.size());
+	while (file >> parent_index >> digits)
+	{
+		// Colors are single digits 0..max_color, one per old vertex
+		bool is_valid = (parent_index < parent->size() && digits.size() == coloring.size());
+		for (auto v = 0; is_valid && v < coloring.size(); ++v)
+		{
+			is_valid = (digits[v] >= '0' && digits[v] - '0' <= max_color);
+			coloring[v] = digits[v] - '0';
+		}
+
+		if (!is_valid)
+		{
+			std::fprintf(
+				stderr,
+				"Level %s has a bad coloring for child %zu\n",
+				path.c_str(),
+				level->size()
+			);
+			return nullptr;
+		}
+		level->addChild(parent_index, coloring);
+	}
+
+	if (!file.eof() || level->size() != count)
+	{
+		std::fprintf(
+			stderr,
+			"Level %s holds %zu of %zu children\n",
+			path.c_str(),
+			level->size(),
+			count
+		);
+		return nullptr;
+	}
+
+	return level;
+}
+
+};	// end of namespace
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+
+namespace Ram
+{
+
+// One level of canonical augmentation. Every child is its parent from the
+// previous level plus one vertex, so non-root levels only store the parent
+// index and the new vertex's edge colors; full graphs are rebuilt on access.
+// The root level (e.g. k2, or a level loaded from .adj) stores full graphs.
+struct LevelStore
+{
+	std::shared_ptr<const LevelStore> parent;
+	size_t num_vertices;
+	Color max_color;
+
+	// Root level only
+	std::vector<EdgeColoredUndirectedGraph> graphs;
+
+	// Child levels: colors of edges (new vertex, 0..num_vertices-2) per child
+	std::vector<uint32_t> parent_indices;
+	std::vector<Color> colorings;
+
+
+	LevelStore(std::vector<EdgeColoredUndirectedGraph> roots) noexcept;
+
+	LevelStore(std::shared_ptr<const LevelStore> parent) noexcept;
+
+	bool isRoot() const noexcept;
+
+	size_t size() const noexcept;
+
+	void addChild(uint32_t parent_index, const std::vector<Color>& coloring) noexcept;
+
+	// Rebuilds graph i. The reference stays valid until the next get() on this
+	// level; rebuilds are cached per level, so walking children of the same
+	// parent in order costs one vertex each. Not safe to share across threads.
+	const EdgeColoredUndirectedGraph& get(size_t i) const noexcept;
+
+	// Rebuild graph i into out without the cache, so workers can share a level
+	void rebuild(size_t i, EdgeColoredUndirectedGraph& out) const noexcept;
+
+	std::vector<EdgeColoredUndirectedGraph> materialize() const noexcept;
+
+private:
+	mutable EdgeColoredUndirectedGraph cache;
+	mutable size_t cache_index = SIZE_MAX;
+
+	// Append child i's vertex to a copy of its parent
+	void extend(size_t i, EdgeColoredUndirectedGraph& g) const noexcept;
+};
+
+
+// .delta format: "delta PARENT_FILE", then "num_vertices max_color count", then
+// one "parent_index colors" line per child with colors written as digits.
+// PARENT_FILE is relative to the .delta file and may be .adj or .delta.
+bool writeLevelDelta(
+	const std::filesystem::path& path,
+	const LevelStore& level,
+	const std::filesystem::path& parent_file);
+
+// Load a .adj file as a root level, or a .delta file with its parent chain.
+// Returns nullptr, after printing why, if a file is missing or malformed.
+std::shared_ptr<LevelStore> loadLevel(const std::filesystem::path& path);
+
+};	// end of namespace
@@ -0,0 +1,150 @@
+#include "Metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace Ram
+{
+
+namespace Metrics
+{
+
+std::atomic<bool> is_enabled { false };
+
+namespace
+{
+
+// Blocks outlive their threads so counts from finished workers survive
+std::mutex registry_lock;
+std::vector<std::unique_ptr<ThreadCounters>> registry;
+
+};	// end of anonymous namespace
+
+
+const char* counterName(Counter c) noexcept
+{
+	switch (c)
+	{
+		case CanonizeCalls: return "canonize_calls";
+		case CanonizeNanos: return "canonize_ns";
+		case NautyRuns: return "nauty_runs";
+		case NautyNodes: return "nauty_numnodes";
+		case EmbedCalls: return "embed_calls";
+		case EmbedNanos: return "embed_ns";
+		case Embeddings: return "embeddings";
+		case CanEmbedCalls: return "can_embed_calls";
+		case TriangleChecks: return "triangle_checks";
+		case TriangleRejections: return "triangle_rejections";
+		case DedupInserts: return "dedup_inserts";
+		case DedupHits: return "dedup_hits";
+		case BytesRead: return "bytes_read";
+		case BytesWritten: return "bytes_written";
+		case CanonizeSkips: return "canonize_skips";
+		case OrbitPrunes: return "orbit_prunes";
+		default: return "unknown";
+	}
+}
+
+
+ThreadCounters& local() noexcept
+{
+	thread_local ThreadCounters* block = nullptr;
+	if (!block)
+	{
+		std::lock_guard<std::mutex> lk(registry_lock);
+		registry.emplace_back(std::make_unique<ThreadCounters>());
+		block = registry.back().get();
+	}
+	return *block;
+}
+
+
+void setEnabled(bool enabled) noexcept
+{
+	is_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+void addGroupSize(double grpsize1, int grpsize2) noexcept
+{
+	if (!enabled() || grpsize1 <= 0) return;
+
+	auto& sum = local().log10_group_size;
+	sum.store(
+		sum.load(std::memory_order_relaxed) + std::log10(grpsize1) + grpsize2,
+		std::memory_order_relaxed
+	);
+}
+
+
+void reset() noexcept
+{
+	std::lock_guard<std::mutex> lk(registry_lock);
+	for (auto& block : registry)
+	{
+		for (auto& c : block->counters) c.store(0, std::memory_order_relaxed);
+		block->log10_group_size.store(0, std::memory_order_relaxed);
+	}
+}
+
+
+Snapshot snapshot() noexcept
+{
+	Snapshot snap;
+
+	std::lock_guard<std::mutex> lk(registry_lock);
+	for (auto& block : registry)
+	{
+		for (auto c = 0; c < NumCounters; ++c)
+		{
+			snap.counters[c] += block->counters[c].load(std::memory_order_relaxed);
+		}
+		snap.log10_group_size += block->log10_group_size.load(std::memory_order_relaxed);
+	}
+
+	return snap;
+}
+
+
+bool writeJson(
+	const std::filesystem::path& path,
+	const std::string& stage,
+	const std::vector<std::pair<std::string, double>>& fields,
+	const Snapshot& snap)
+{
+	if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream out(path);
+	if (!out.is_open())
+	{
+		std::fprintf(stderr, "Cannot write metrics to %s\n", path.c_str());
+		return false;
+	}
+
+	out << "{\n";
+	out << "\t\"stage\": \"" << stage << "\",\n";
+	for (const auto& [name, value] : fields)
+	{
+		out << "\t\"" << name << "\": " << value << ",\n";
+	}
+
+	out << "\t\"counters\": {\n";
+	for (auto c = 0; c < NumCounters; ++c)
+	{
+		out << "\t\t\"" << counterName(static_cast<Counter>(c)) << "\": "
+			<< snap.counters[c] << ",\n";
+	}
+	out << "\t\t\"nauty_log10_grpsize_sum\": " << snap.log10_group_size << "\n";
+	out << "\t}\n";
+	out << "}\n";
+
+	std::printf("Wrote metrics to %s\n", path.c_str());
+	return true;
+}
+
+};	// end of namespace Metrics
+
+};	// end of namespace
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Ram
+{
+
+namespace Metrics
+{
+
+enum Counter : size_t
+{
+	CanonizeCalls,
+	CanonizeNanos,
+	NautyRuns,
+	NautyNodes,
+	EmbedCalls,
+	EmbedNanos,
+	Embeddings,
+	CanEmbedCalls,
+	TriangleChecks,
+	TriangleRejections,
+	DedupInserts,
+	DedupHits,
+	BytesRead,
+	BytesWritten,
+	CanonizeSkips,
+	OrbitPrunes,
+	NumCounters
+};
+
+const char* counterName(Counter c) noexcept;
+
+
+// Counters are kept per thread and summed on snapshot(), so recording
+// never contends. When disabled every recording call is one relaxed load.
+struct ThreadCounters
+{
+	std::array<std::atomic<uint64_t>, NumCounters> counters {};
+
+	// Sum of log10 of nauty group sizes, which overflow as plain numbers
+	std::atomic<double> log10_group_size { 0 };
+};
+
+struct Snapshot
+{
+	std::array<uint64_t, NumCounters> counters {};
+	double log10_group_size = 0;
+};
+
+extern std::atomic<bool> is_enabled;
+
+ThreadCounters& local() noexcept;
+
+
+inline bool enabled() noexcept
+{
+	return is_enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled) noexcept;
+
+inline void add(Counter c, uint64_t n = 1) noexcept
+{
+	if (!enabled()) return;
+
+	// Only the owning thread writes, so load+store needs no RMW
+	auto& counter = local().counters[c];
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void addGroupSize(double grpsize1, int grpsize2) noexcept;
+
+// Zero every thread's counters
+void reset() noexcept;
+
+Snapshot snapshot() noexcept;
+
+
+// Adds the lifetime of the timer in nanoseconds to a counter
+struct ScopedTimer
+{
+	using Clock = std::chrono::steady_clock;
+
+	Counter counter;
+	bool active;
+	Clock::time_point start;
+
+	ScopedTimer(Counter counter) noexcept
+		: counter(counter)
+		, active(enabled())
+	{
+		if (active) start = Clock::now();
+	}
+
+	~ScopedTimer() noexcept
+	{
+		if (!active) return;
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+		add(counter, ns.count());
+	}
+};
+
+
+// Write one stage run as a JSON object: the stage name, extra numeric
+// fields (wall time, graph counts, ...) and every counter
+bool writeJson(
+	const std::filesystem::path& path,
+	const std::string& stage,
+	const std::vector<std::pair<std::string, double>>& fields,
+	const Snapshot& snap);
+
+};	// end of namespace Metrics
+
+};	// end of namespace
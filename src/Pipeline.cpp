@@ -0,0 +1,524 @@
+#include "Pipeline.h"
+#include "Canonizer.h"
+#include "GraphUtils.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "k62.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace Ram
+{
+
+namespace
+{
+
+std::vector<Stage> makeBuiltinStages() noexcept
+{
+	using Graphs = Stage::Graphs;
+
+	std::vector<Stage> builtin;
+	builtin.push_back({
+		"upsilon62_1", StageData::None, StageData::Graphs,
+		"", "graphs/62/upsilon1.adj",
+		k62CanonSpec(),
+		[](const Graphs&, const StageContext&) {
+			return upsilon62_1("");
+		}
+	});
+	builtin.push_back({
+		"upsilon62_2", StageData::Graphs, StageData::Graphs,
+		"graphs/62/upsilon1.adj", "graphs/62/upsilon2.adj",
+		k62CanonSpec(),
+		[](const Graphs& in, const StageContext&) {
+			return upsilon62_2(in, "");
+		}
+	});
+	builtin.push_back({
+		"upsilon62_3", StageData::Graphs, StageData::Graphs,
+		"graphs/62/upsilon2.adj", "graphs/62/upsilon3.adj",
+		k62CanonSpec(),
+		[](const Graphs& in, const StageContext&) {
+			return upsilon62_3(in, "");
+		}
+	});
+	builtin.push_back({
+		"upsilon62_4", StageData::Graphs, StageData::Graphs,
+		"graphs/62/upsilon3.adj", "graphs/62/upsilon4.adj",
+		k62CanonSpec(),
+		[](const Graphs& in, const StageContext& ctx) {
+			return upsilon62_4(in, ctx.output_path, ctx.dedup, ctx.num_threads);
+		}
+	});
+	builtin.push_back({
+		"upsilon62_5", StageData::Graphs, StageData::Graphs,
+		"graphs/62/upsilon4.adj", "graphs/62/upsilon5.adj",
+		k62CanonSpec(),
+		[](const Graphs& in, const StageContext& ctx) {
+			return upsilon62_5(in, ctx.output_path, ctx.dedup, ctx.num_threads);
+		}
+	});
+
+	return builtin;
+}
+
+std::vector<Stage>& registry() noexcept
+{
+	static std::vector<Stage> registered = makeBuiltinStages();
+	return registered;
+}
+
+// Graphs in an .adj file, counted by their header lines without loading them
+size_t countGraphsAdj(const std::filesystem::path& path)
+{
+	std::ifstream file(path);
+	size_t count = 0;
+	bool in_record = false;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty()) in_record = false;
+		else if (!in_record)
+		{
+			++count;
+			in_record = true;
+		}
+	}
+
+	return count;
+}
+
+// Descriptor that graph data is written to when the output is "-".
+// Stages log progress on stdout, so stdout is pointed at stderr while
+// the pipeline runs and the original stdout is kept for the graphs.
+int data_fd = -1;
+
+};	// end of anonymous namespace
+
+
+const std::vector<Stage>& stages() noexcept
+{
+	return registry();
+}
+
+
+const Stage* findStage(const std::string& name) noexcept
+{
+	for (const auto& stage : registry())
+	{
+		if (stage.name == name) return &stage;
+	}
+	return nullptr;
+}
+
+
+void registerStage(Stage stage) noexcept
+{
+	registry().push_back(std::move(stage));
+}
+
+
+std::optional<GraphFormat> parseGraphFormat(const std::string& name) noexcept
+{
+	if (name == "adj") return GraphFormat::Adj;
+	if (name == "mc") return GraphFormat::MC;
+	return std::nullopt;
+}
+
+
+std::vector<EdgeColoredUndirectedGraph> readGraphs(
+	const std::filesystem::path& path,
+	GraphFormat format)
+{
+	if (path == "-")
+	{
+		return (format == GraphFormat::Adj)
+			? loadBulkAdj(std::cin)
+			: loadBulkMC(std::cin);
+	}
+
+	return (format == GraphFormat::Adj)
+		? loadBulkAdj(path)
+		: loadBulkMC(path);
+}
+
+
+void writeGraphs(
+	const std::filesystem::path& path,
+	GraphFormat format,
+	const std::vector<EdgeColoredUndirectedGraph>& graphs)
+{
+	if (path != "-")
+	{
+		if (format == GraphFormat::Adj) writeGraphsToFileAdj(path, graphs);
+		else writeGraphsToFileMC(path, graphs);
+		return;
+	}
+
+	std::stringstream ss;
+	if (format == GraphFormat::Adj) writeGraphsAdj(ss, graphs);
+	else writeGraphsMC(ss, graphs);
+
+	auto data = ss.str();
+	int fd = (data_fd >= 0) ? data_fd : STDOUT_FILENO;
+	for (size_t written = 0; written < data.size();)
+	{
+		auto n = write(fd, data.data() + written, data.size() - written);
+		if (n <= 0) break;
+		written += n;
+	}
+}
+
+
+bool runPipeline(const PipelineOptions& options)
+{
+	const auto& all = stages();
+
+	// Resolve stage range
+	size_t first = all.size();
+	size_t last = all.size();
+	for (size_t i = 0; i < all.size(); ++i)
+	{
+		if (all[i].name == options.from) first = i;
+		if (all[i].name == options.to) last = i;
+	}
+
+	if (first == all.size() || last == all.size() || first > last)
+	{
+		std::fprintf(
+			stderr,
+			"Invalid stage range %s..%s\n",
+			options.from.c_str(),
+			options.to.c_str()
+		);
+		return false;
+	}
+
+	// Keep stdout clean for graph data
+	if (options.output_path == "-")
+	{
+		std::fflush(stdout);
+		data_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	auto writeAut = [&](const std::filesystem::path& path, const Stage::Graphs& gs) {
+		if (!options.write_aut || path == "-") return;
+
+		TaskScheduler scheduler(options.context.num_threads);
+		auto groups = automorphismGroups(scheduler, gs);
+		writeAutGroups(autPath(path), groups);
+	};
+
+	auto writeStageGraphs = [&](const std::filesystem::path& path, const Stage::Graphs& gs) {
+		writeGraphs(path, options.output_format, gs);
+		writeAut(path, gs);
+	};
+
+	bool is_sharded = options.shard_count > 1;
+	auto keepShard = [&](Stage::Graphs& gs) {
+		Stage::Graphs kept;
+		for (auto& g : gs)
+		{
+			if (inShard(g, options.shard_index, options.shard_count))
+			{
+				kept.emplace_back(std::move(g));
+			}
+		}
+		gs = std::move(kept);
+	};
+
+	// Load input of first stage
+	Stage::Graphs graphs;
+	if (all[first].input == StageData::Graphs)
+	{
+		auto in_path = options.input_path.empty()
+			? all[first].default_input
+			: options.input_path;
+		graphs = readGraphs(in_path, options.input_format);
+		std::printf("Loaded %zu graphs from %s\n", graphs.size(), in_path.c_str());
+
+		if (is_sharded)
+		{
+			keepShard(graphs);
+			std::printf(
+				"Shard %d/%d keeps %zu graphs\n",
+				options.shard_index,
+				options.shard_count,
+				graphs.size()
+			);
+		}
+	}
+
+	auto out_path = options.output_path;
+	if (out_path.empty())
+	{
+		out_path = all[last].default_output;
+		if (is_sharded)
+		{
+			out_path = shardPath(out_path, options.shard_index, options.shard_count);
+		}
+	}
+
+	// With external dedup, stages may merge their output into a file in a
+	// per-process directory, or the last one straight into an .adj output
+	std::filesystem::path spill_dir;
+	if (options.context.dedup.external)
+	{
+		std::stringstream name;
+		name << "pipeline-" << getpid();
+		spill_dir = options.context.dedup.scratch_dir / name.str();
+		std::filesystem::create_directories(spill_dir);
+	}
+
+	// Run stages, passing graphs in memory
+	bool has_metrics = !options.metrics_dir.empty();
+	Metrics::setEnabled(has_metrics);
+	std::filesystem::path spill_path;
+	bool in_file = false;
+	for (size_t i = first; i <= last; ++i)
+	{
+		const auto& stage = all[i];
+		auto num_input = graphs.size();
+		Metrics::reset();
+		auto start_time = std::chrono::high_resolution_clock::now();
+
+		auto context = options.context;
+		if (!spill_dir.empty())
+		{
+			bool is_direct = (i == last && out_path != "-" && options.output_format == GraphFormat::Adj);
+			spill_path = is_direct ? out_path : spill_dir / (stage.name + ".adj");
+			context.output_path = spill_path;
+
+			// A file left from an earlier run must not pass for this stage's output
+			std::error_code ec;
+			std::filesystem::remove(spill_path, ec);
+		}
+
+		{
+			Trace::Span stage_span(stage.name.c_str(), "stage", "input_graphs", num_input);
+			graphs = stage.run(graphs, context);
+		}
+		in_file = !context.output_path.empty() && std::filesystem::exists(context.output_path);
+
+		// Generators have no input to slice, so slice what they produce
+		if (is_sharded && i == first && stage.input == StageData::None)
+		{
+			keepShard(graphs);
+		}
+
+		auto end_time = std::chrono::high_resolution_clock::now();
+		Timing::seconds time = end_time - start_time;
+		auto num_output = in_file ? countGraphsAdj(spill_path) : graphs.size();
+		std::printf(
+			"Stage %s produced %zu graphs in %.2f seconds.\n",
+			stage.name.c_str(),
+			num_output,
+			time.count()
+		);
+
+		if (has_metrics)
+		{
+			auto metrics_path = options.metrics_dir / (stage.name + ".json");
+			if (is_sharded)
+			{
+				metrics_path = shardPath(metrics_path, options.shard_index, options.shard_count);
+			}
+
+			Metrics::writeJson(metrics_path, stage.name, {
+				{ "wall_seconds", time.count() },
+				{ "threads", static_cast<double>(options.context.num_threads) },
+				{ "input_graphs", static_cast<double>(num_input) },
+				{ "output_graphs", static_cast<double>(num_output) }
+			}, Metrics::snapshot());
+		}
+
+		// The next stage reads a merged file once its producer has let go
+		// of its dedup state
+		if (in_file && i != last)
+		{
+			graphs = readGraphs(spill_path, GraphFormat::Adj);
+			std::filesystem::remove(spill_path);
+			in_file = false;
+		}
+
+		if (!options.keep_dir.empty() && i != last)
+		{
+			std::filesystem::create_directories(options.keep_dir);
+			auto keep_path = options.keep_dir / all[i].default_output.filename();
+			if (is_sharded)
+			{
+				keep_path = shardPath(keep_path, options.shard_index, options.shard_count);
+			}
+			writeStageGraphs(keep_path, graphs);
+		}
+	}
+
+	// Write output of last stage
+	if (!in_file)
+	{
+		writeStageGraphs(out_path, graphs);
+	}
+	else if (spill_path != out_path)
+	{
+		writeStageGraphs(out_path, readGraphs(spill_path, GraphFormat::Adj));
+	}
+	else
+	{
+		writeAut(out_path, readGraphs(out_path, GraphFormat::Adj));
+	}
+
+	if (!spill_dir.empty())
+	{
+		std::error_code ec;
+		std::filesystem::remove_all(spill_dir, ec);
+	}
+
+	if (data_fd >= 0)
+	{
+		std::fflush(stdout);
+		dup2(data_fd, STDOUT_FILENO);
+		close(data_fd);
+		data_fd = -1;
+	}
+
+	return true;
+}
+
+bool inShard(const EdgeColoredUndirectedGraph& g, int shard_index, int shard_count) noexcept
+{
+	// Isomorphic graphs share an invariant hash, so they share a shard
+	return invariantHash(g) % shard_count == static_cast<uint64_t>(shard_index);
+}
+
+
+std::filesystem::path shardPath(
+	const std::filesystem::path& path,
+	int shard_index,
+	int shard_count) noexcept
+{
+	std::stringstream name;
+	name << path.stem().string()
+		<< ".shard" << shard_index << "of" << shard_count
+		<< path.extension().string();
+
+	return path.parent_path() / name.str();
+}
+
+
+bool mergeShards(const MergeOptions& options)
+{
+	if (options.input_paths.empty() || options.output_path.empty())
+	{
+		std::fprintf(stderr, "merge needs an output path and at least one shard\n");
+		return false;
+	}
+
+	for (const auto& path : options.input_paths)
+	{
+		if (!std::filesystem::exists(path))
+		{
+			std::fprintf(stderr, "Missing shard %s\n", path.c_str());
+			return false;
+		}
+	}
+
+	bool has_metrics = !options.metrics_dir.empty();
+	Metrics::setEnabled(has_metrics);
+	Metrics::reset();
+	auto start_time = std::chrono::high_resolution_clock::now();
+	Trace::Span merge_span("merge", "stage", "shards", options.input_paths.size());
+
+	TaskScheduler scheduler(options.context.num_threads);
+	std::unique_ptr<ExternalDedup> external;
+	if (options.context.dedup.external)
+	{
+		external = std::make_unique<ExternalDedup>(options.context.dedup);
+	}
+
+	Stage::Graphs graphs;
+	std::unordered_set<std::string> canons;
+	size_t num_read = 0;
+	size_t num_distinct = 0;
+	for (const auto& path : options.input_paths)
+	{
+		auto shard = readGraphs(path, options.input_format);
+		num_read += shard.size();
+
+		// Canonize in parallel, then dedup in input order
+		auto shard_canons = canonizeAll(scheduler, shard, options.canon_spec);
+
+		for (auto i = 0; i < shard.size(); ++i)
+		{
+			if (external)
+			{
+				external->add(shard_canons[i], shard[i]);
+			}
+			else if (canons.insert(std::move(shard_canons[i])).second)
+			{
+				graphs.emplace_back(std::move(shard[i]));
+			}
+		}
+
+		std::printf("Merged %s (%zu graphs)\n", path.c_str(), shard.size());
+	}
+
+	if (external)
+	{
+		// .adj output is merged straight into the output file; other outputs
+		// collect the graphs without a scratch file
+		if (options.output_path != "-" && options.output_format == GraphFormat::Adj)
+		{
+			num_distinct = external->finish(options.output_path);
+		}
+		else
+		{
+			num_distinct = external->finish({}, [&](const EdgeColoredUndirectedGraph& g) {
+				graphs.push_back(g);
+			});
+			writeGraphs(options.output_path, options.output_format, graphs);
+		}
+	}
+	else
+	{
+		num_distinct = graphs.size();
+		writeGraphs(options.output_path, options.output_format, graphs);
+	}
+
+	std::printf(
+		"Merged %zu shards: %zu graphs, %zu distinct\n",
+		options.input_paths.size(),
+		num_read,
+		num_distinct
+	);
+
+	if (has_metrics)
+	{
+		// In-memory dedup is a plain set, so count its traffic here
+		if (!external)
+		{
+			Metrics::add(Metrics::DedupInserts, num_read);
+			Metrics::add(Metrics::DedupHits, num_read - num_distinct);
+		}
+
+		auto end_time = std::chrono::high_resolution_clock::now();
+		Timing::seconds time = end_time - start_time;
+		Metrics::writeJson(options.metrics_dir / "merge.json", "merge", {
+			{ "wall_seconds", time.count() },
+			{ "threads", static_cast<double>(options.context.num_threads) },
+			{ "input_graphs", static_cast<double>(num_read) },
+			{ "output_graphs", static_cast<double>(num_distinct) }
+		}, Metrics::snapshot());
+	}
+
+	return true;
+}
+
+};	// end of namespace
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+#include "ExternalDedup.h"
+#include "GraphUtils.h"
+
+namespace Ram
+{
+
+enum class GraphFormat
+{
+	Adj,
+	MC
+};
+
+// What a stage consumes or produces
+enum class StageData
+{
+	None,
+	Graphs
+};
+
+// Settings shared by every stage of a pipeline run
+struct StageContext
+{
+	int num_threads = 1;
+	DedupOptions dedup;
+
+	// Set by runPipeline with external dedup. A stage that merges on disk
+	// may write its graphs here as .adj instead of returning them, and the
+	// pipeline reads them from the file only once the stage is done.
+	std::filesystem::path output_path;
+};
+
+struct Stage
+{
+	using Graphs = std::vector<EdgeColoredUndirectedGraph>;
+	using Run = std::function<Graphs(const Graphs&, const StageContext&)>;
+
+	std::string name;
+	StageData input;
+	StageData output;
+
+	// Files used when a stage is run on its own without explicit paths
+	std::filesystem::path default_input;
+	std::filesystem::path default_output;
+
+	// How the stage tells its graphs apart. Merges, indexes and checks of
+	// its output must canonize with the same spec.
+	CanonSpec canon_spec;
+
+	Run run;
+};
+
+struct PipelineOptions
+{
+	std::string from;
+	std::string to;
+
+	// Empty path means the stage default, "-" means stdin/stdout
+	std::filesystem::path input_path;
+	std::filesystem::path output_path;
+	GraphFormat input_format = GraphFormat::Adj;
+	GraphFormat output_format = GraphFormat::Adj;
+
+	// Also write every intermediate stage output into this directory
+	std::filesystem::path keep_dir;
+
+	// Write <stage>.json metrics per stage run into this directory
+	std::filesystem::path metrics_dir;
+
+	// Write each graph file's automorphism groups to a .aut sidecar
+	bool write_aut = false;
+
+	// Process only input graphs whose invariant hash is shard_index
+	// modulo shard_count
+	int shard_index = 0;
+	int shard_count = 1;
+
+	StageContext context;
+};
+
+struct MergeOptions
+{
+	std::vector<std::filesystem::path> input_paths;
+	std::filesystem::path output_path;
+	GraphFormat input_format = GraphFormat::Adj;
+	GraphFormat output_format = GraphFormat::Adj;
+
+	// Write merge.json metrics into this directory
+	std::filesystem::path metrics_dir;
+
+	// Spec of the stage that wrote the shards
+	CanonSpec canon_spec;
+
+	StageContext context;
+};
+
+
+// Stage registry, in pipeline order
+const std::vector<Stage>& stages() noexcept;
+
+const Stage* findStage(const std::string& name) noexcept;
+
+void registerStage(Stage stage) noexcept;
+
+
+// IO
+std::optional<GraphFormat> parseGraphFormat(const std::string& name) noexcept;
+
+std::vector<EdgeColoredUndirectedGraph> readGraphs(
+	const std::filesystem::path& path,
+	GraphFormat format);
+
+void writeGraphs(
+	const std::filesystem::path& path,
+	GraphFormat format,
+	const std::vector<EdgeColoredUndirectedGraph>& graphs);
+
+
+// Run stages from..to, handing graphs between them in memory.
+// Returns false if the requested range is invalid.
+bool runPipeline(const PipelineOptions& options);
+
+
+// Sharding
+bool inShard(const EdgeColoredUndirectedGraph& g, int shard_index, int shard_count) noexcept;
+
+// upsilon4.adj -> upsilon4.shard3of8.adj
+std::filesystem::path shardPath(
+	const std::filesystem::path& path,
+	int shard_index,
+	int shard_count) noexcept;
+
+// Combine shard outputs into one file with one graph per isomorphism class.
+// Graphs keep the order of the inputs, first occurrence winning.
+bool mergeShards(const MergeOptions& options);
+
+};	// end of namespace
@@ -0,0 +1,229 @@
+#include "Regression.h"
+#include "CanonicalAugmentation.h"
+#include "k62.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace Ram
+{
+
+namespace
+{
+
+// Time one pipeline stage fed with in-memory graphs
+RegressionCase runStage(
+	const std::string& name,
+	Stage::Graphs& graphs,
+	const StageContext& context)
+{
+	const auto* stage = findStage(name);
+	assert(stage && "runRegression() Failed: stage not registered.");
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	graphs = stage->run(graphs, context);
+	auto end_time = std::chrono::high_resolution_clock::now();
+	Timing::seconds time = end_time - start_time;
+
+	return { name, graphs.size(), time.count(), 0 };
+}
+
+// Time the first attaching vertex step of upsilon62_5 on a sample of upsilon4,
+// with or without orbit pruning. Later steps cull every partial of the sample,
+// and an empty result would compare nothing.
+RegressionCase runUpsilon5(
+	const std::string& name,
+	const std::vector<EdgeColoredUndirectedGraph>& upsilon4,
+	bool prune_orbits,
+	const StageContext& context)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+	auto graphs = upsilon62_5(upsilon4, "", context.dedup, context.num_threads, prune_orbits, 1);
+	auto end_time = std::chrono::high_resolution_clock::now();
+	Timing::seconds time = end_time - start_time;
+
+	return { name, graphs.size(), time.count(), 0 };
+}
+
+};	// end of anonymous namespace
+
+
+std::vector<RegressionCase> loadGolden(const std::filesystem::path& path)
+{
+	std::vector<RegressionCase> cases;
+
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+
+		// The baseline time is optional; without one only the count is checked
+		std::stringstream ss(line);
+		RegressionCase c { "", 0, 0, 0 };
+		if (ss >> c.name >> c.count)
+		{
+			ss >> c.relative_time;
+			cases.push_back(c);
+		}
+	}
+
+	return cases;
+}
+
+
+bool writeGolden(const std::filesystem::path& path, const std::vector<RegressionCase>& cases)
+{
+	if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		std::fprintf(stderr, "Cannot write golden file %s\n", path.c_str());
+		return false;
+	}
+
+	file << "# case classes relative_time\n";
+	file << "# Times are relative to the reference case; cases without one only check their count.\n";
+	for (const auto& c : cases)
+	{
+		file << c.name << " " << c.count << " " << c.relative_time << "\n";
+	}
+
+	std::printf("Recorded %zu cases to %s\n", cases.size(), path.c_str());
+	return true;
+}
+
+
+bool runRegression(const RegressionOptions& options)
+{
+	// The golden file is checked in, so a missing one is an error, not a
+	// first run
+	std::vector<RegressionCase> golden;
+	if (!options.record)
+	{
+		if (!std::filesystem::exists(options.golden_path))
+		{
+			std::fprintf(stderr, "Golden file %s is missing\n", options.golden_path.c_str());
+			return false;
+		}
+
+		golden = loadGolden(options.golden_path);
+		if (golden.empty())
+		{
+			std::fprintf(stderr, "Golden file %s has no cases\n", options.golden_path.c_str());
+			return false;
+		}
+	}
+
+	std::vector<RegressionCase> cases;
+
+	// Canonical augmentation of 3-colored complete graphs
+	auto levels = augment(
+		3,
+		9,
+		3,
+		options.context.dedup,
+		options.scratch_dir,
+		false,
+		options.context.num_threads
+	);
+	for (const auto& level : levels)
+	{
+		std::stringstream name;
+		name << "augment/k" << level.k;
+		cases.push_back({ name.str(), level.num_distinct, level.seconds, 0 });
+	}
+
+	// Marked subsets and overlaps of T1, T2
+	Stage::Graphs graphs;
+	cases.push_back(runStage("upsilon62_1", graphs, options.context));
+	cases.push_back(runStage("upsilon62_2", graphs, options.context));
+
+	// Orbit pruning must not change the classes upsilon62_5 finds
+	if (!std::filesystem::exists(options.upsilon4_sample_path))
+	{
+		std::fprintf(stderr, "Sample %s is missing\n", options.upsilon4_sample_path.c_str());
+		return false;
+	}
+	auto upsilon4 = readGraphs(options.upsilon4_sample_path, GraphFormat::Adj);
+	auto pruned = runUpsilon5("upsilon62_5/sample", upsilon4, true, options.context);
+	auto unpruned = runUpsilon5("upsilon62_5/unpruned", upsilon4, false, options.context);
+	cases.push_back(pruned);
+	cases.push_back(unpruned);
+	if (pruned.count != unpruned.count)
+	{
+		std::fprintf(
+			stderr,
+			"upsilon62_5 finds %zu classes with orbit pruning and %zu without\n",
+			pruned.count,
+			unpruned.count
+		);
+		return false;
+	}
+
+	// Express every time relative to the reference case
+	double reference_seconds = 0;
+	for (const auto& c : cases)
+	{
+		if (c.name == options.reference_case) reference_seconds = c.seconds;
+	}
+	if (reference_seconds <= 0)
+	{
+		std::fprintf(stderr, "Reference case %s was not timed\n", options.reference_case.c_str());
+		return false;
+	}
+	for (auto& c : cases) c.relative_time = c.seconds / reference_seconds;
+
+	if (options.record) return writeGolden(options.golden_path, cases);
+
+
+	// Compare against the golden file
+	size_t num_failed = 0;
+	for (const auto& expected : golden)
+	{
+		const RegressionCase* actual = nullptr;
+		for (const auto& c : cases)
+		{
+			if (c.name == expected.name) actual = &c;
+		}
+
+		const char* status = nullptr;
+		if (!actual)
+		{
+			status = "MISSING";
+		}
+		else if (actual->count != expected.count)
+		{
+			status = "WRONG COUNT";
+		}
+		else if (
+			expected.relative_time > 0 &&
+			actual->relative_time > expected.relative_time * options.tolerance &&
+			actual->seconds - expected.relative_time * reference_seconds > options.min_seconds)
+		{
+			status = "SLOWER";
+		}
+
+		std::printf(
+			"%-20s %10zu (golden %10zu) %9.3fs %8.3fx (baseline %8.3fx)  %s\n",
+			expected.name.c_str(),
+			actual ? actual->count : 0,
+			expected.count,
+			actual ? actual->seconds : 0.0,
+			actual ? actual->relative_time : 0.0,
+			expected.relative_time,
+			status ? status : "ok"
+		);
+
+		if (status) ++num_failed;
+	}
+
+	std::printf("\n%zu of %zu cases failed\n", num_failed, golden.size());
+	return num_failed == 0;
+}
+
+};	// end of namespace
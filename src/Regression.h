@@ -0,0 +1,62 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Pipeline.h"
+
+namespace Ram
+{
+
+// One checked quantity: how many classes a case produced and how long it took.
+// Golden files store the time relative to the reference case, which carries
+// over between machines where seconds do not.
+struct RegressionCase
+{
+	std::string name;
+	size_t count;
+	double seconds;
+	double relative_time;
+};
+
+struct RegressionOptions
+{
+	std::filesystem::path golden_path = "graphs/golden.txt";
+
+	// Overwrite the golden file with this run instead of comparing
+	bool record = false;
+
+	// Times are measured relative to this case, whose own time is not gated
+	std::string reference_case = "augment/k8";
+
+	// A case regresses when its relative time exceeds tolerance * baseline
+	double tolerance = 1.25;
+
+	// Timings below this many seconds are too noisy to gate on
+	double min_seconds = 0.05;
+
+	// Checked-in upsilon4 graphs that upsilon62_5 runs on with and without
+	// orbit pruning
+	std::filesystem::path upsilon4_sample_path = "graphs/upsilon4_sample.adj";
+
+	// Augment levels are written here, not into graphs/
+	std::filesystem::path scratch_dir = "graphs/tmp/regress";
+
+	StageContext context;
+};
+
+
+// Run augment k3-k9 with 3 colors, upsilon62_1/2 from graphs/T1.adj and
+// graphs/T2.adj, and upsilon62_5 on the upsilon4 sample with and without
+// orbit pruning. Returns false if the golden file is missing, a class count
+// differs from it, pruning changes the upsilon62_5 count, or a case is slower
+// relative to the reference case than its recorded baseline allows. Cases
+// without a baseline are only checked for their count.
+bool runRegression(const RegressionOptions& options);
+
+std::vector<RegressionCase> loadGolden(const std::filesystem::path& path);
+
+bool writeGolden(const std::filesystem::path& path, const std::vector<RegressionCase>& cases);
+
+};	// end of namespace
@@ -0,0 +1,129 @@
+#include "Scheduler.h"
+
+#include <chrono>
+
+namespace Ram
+{
+
+namespace
+{
+
+thread_local int tls_worker_index = 0;
+
+};	// end of anonymous namespace
+
+
+TaskScheduler::TaskScheduler(int num_threads) noexcept
+{
+	num_threads = std::max(num_threads, 1);
+	for (auto i = 0; i < num_threads; ++i)
+	{
+		workers.emplace_back(std::make_unique<Worker>());
+	}
+
+	// Calling thread acts as worker 0
+	for (auto i = 1; i < num_threads; ++i)
+	{
+		threads.emplace_back([this, i] { workerLoop(i); });
+	}
+}
+
+
+TaskScheduler::~TaskScheduler() noexcept
+{
+	stop = true;
+	idle_cv.notify_all();
+	for (auto& t : threads) t.join();
+}
+
+
+int TaskScheduler::numThreads() const noexcept
+{
+	return workers.size();
+}
+
+
+int TaskScheduler::workerIndex() noexcept
+{
+	return tls_worker_index;
+}
+
+
+void TaskScheduler::spawn(TaskGroup& group, Task task) noexcept
+{
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+
+	auto& w = *workers[workerIndex()];
+	{
+		std::lock_guard<std::mutex> lk(w.lock);
+		w.tasks.push_back({ std::move(task), &group });
+	}
+
+	num_queued.fetch_add(1, std::memory_order_release);
+	idle_cv.notify_one();
+}
+
+
+void TaskScheduler::wait(TaskGroup& group) noexcept
+{
+	auto self = workerIndex();
+	while (group.pending.load(std::memory_order_acquire) > 0)
+	{
+		if (!runOne(self)) std::this_thread::yield();
+	}
+}
+
+
+bool TaskScheduler::runOne(int self) noexcept
+{
+	Item item { nullptr, nullptr };
+
+	// Newest local task first
+	{
+		auto& w = *workers[self];
+		std::lock_guard<std::mutex> lk(w.lock);
+		if (!w.tasks.empty())
+		{
+			item = std::move(w.tasks.back());
+			w.tasks.pop_back();
+		}
+	}
+
+	// Otherwise steal the oldest task of another worker
+	for (auto k = 1; !item.fn && k < numThreads(); ++k)
+	{
+		auto& victim = *workers[(self + k) % numThreads()];
+		std::lock_guard<std::mutex> lk(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			item = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+	}
+
+	if (!item.fn) return false;
+
+	num_queued.fetch_sub(1, std::memory_order_relaxed);
+	item.fn();
+	item.group->pending.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+
+void TaskScheduler::workerLoop(int self) noexcept
+{
+	tls_worker_index = self;
+	while (!stop)
+	{
+		if (runOne(self)) continue;
+
+		// Sleep until work is queued. The timeout covers a spawn that
+		// notifies between the predicate check and the wait.
+		std::unique_lock<std::mutex> lk(idle_lock);
+		idle_cv.wait_for(lk, std::chrono::milliseconds(1), [&] {
+			return stop || num_queued.load(std::memory_order_acquire) > 0;
+		});
+	}
+}
+
+};	// end of namespace
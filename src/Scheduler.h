@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Metrics.h"
+
+namespace Ram
+{
+
+// Counts the outstanding tasks spawned into it
+struct TaskGroup
+{
+	std::atomic<size_t> pending { 0 };
+};
+
+
+// Work-stealing task pool.
+//
+// Every worker owns a deque: it pushes and pops its own tasks at the back
+// (LIFO, so recursively split work stays cache-local) and steals from the
+// front of other deques (FIFO, so thieves take the largest halves). The
+// thread that constructs the scheduler is worker 0 and only runs tasks
+// while it waits on a group; the remaining workers are background threads.
+struct TaskScheduler
+{
+	using Task = std::function<void()>;
+
+	TaskScheduler(int num_threads) noexcept;
+
+	~TaskScheduler() noexcept;
+
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+	int numThreads() const noexcept;
+
+	// Index of the calling worker, 0 for threads outside the pool
+	static int workerIndex() noexcept;
+
+	void spawn(TaskGroup& group, Task task) noexcept;
+
+	// Run queued tasks until every task of group has finished
+	void wait(TaskGroup& group) noexcept;
+
+private:
+	struct Item
+	{
+		Task fn;
+		TaskGroup* group;
+	};
+
+	struct alignas(64) Worker
+	{
+		std::mutex lock;
+		std::deque<Item> tasks;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> num_queued { 0 };
+	std::atomic<bool> stop { false };
+
+	std::mutex idle_lock;
+	std::condition_variable idle_cv;
+
+	bool runOne(int self) noexcept;
+
+	void workerLoop(int self) noexcept;
+};
+
+
+// One value per worker, padded against false sharing
+template <typename T>
+struct PerWorker
+{
+	struct alignas(64) Slot
+	{
+		T value;
+	};
+
+	std::vector<Slot> slots;
+
+	PerWorker(const TaskScheduler& scheduler)
+		: slots(scheduler.numThreads())
+	{ }
+
+	T& local() noexcept
+	{
+		return slots[TaskScheduler::workerIndex()].value;
+	}
+};
+
+
+// Run fn(i) for i in [begin, end). The range is halved recursively: the
+// running worker keeps the left half and exposes the right half to thieves,
+// so uneven iterations get rebalanced instead of pinned to one thread.
+template <typename F>
+void parallelFor(
+	TaskScheduler& scheduler,
+	size_t begin,
+	size_t end,
+	const F& fn,
+	size_t grain = 1) noexcept
+{
+	if (begin >= end) return;
+	grain = std::max<size_t>(grain, 1);
+
+	TaskGroup group;
+	std::function<void(size_t, size_t)> split = [&](size_t b, size_t e)
+	{
+		while (e - b > grain)
+		{
+			auto mid = b + (e - b) / 2;
+			scheduler.spawn(group, [&split, mid, e] { split(mid, e); });
+			e = mid;
+		}
+
+		for (auto i = b; i < e; ++i) fn(i);
+	};
+
+	split(begin, end);
+	scheduler.wait(group);
+}
+
+
+// Thread-local collection of deduplicated results. Each isomorphism class
+// keeps the entry with the smallest tag; tags give the position a result
+// would have had in the sequential loop nest, so merging buffers reproduces
+// the single-threaded output order exactly.
+//
+// Entries are bucketed by an invariant hash and canonized lazily: canon stays
+// empty until another entry with the same hash shows up, here or in another
+// worker's buffer at merge time. canon_of(value) computes a missing canon.
+template <typename Tag, typename Value>
+struct TaggedCanonBuffer
+{
+	struct Entry
+	{
+		Tag tag;
+		uint64_t hash;
+		std::string canon;
+		Value value;
+	};
+
+	std::vector<Entry> entries;
+	std::unordered_multimap<uint64_t, size_t> index;
+
+	// Buffers whose survivors are inserted into another buffer leave the
+	// dedup counters to that one, so each result is counted once
+	bool counts_dedup = true;
+
+	template <typename F>
+	void insert(const Tag& tag, uint64_t hash, std::string canon, Value value, const F& canon_of)
+	{
+		if (counts_dedup) Metrics::add(Metrics::DedupInserts);
+
+		auto [first, last] = index.equal_range(hash);
+		if (first == last)
+		{
+			Metrics::add(Metrics::CanonizeSkips);
+			index.emplace(hash, entries.size());
+			entries.push_back({ tag, hash, std::move(canon), std::move(value) });
+			return;
+		}
+
+		if (canon.empty()) canon = canon_of(value);
+		for (auto it = first; it != last; ++it)
+		{
+			auto& existing = entries[it->second];
+			if (existing.canon.empty()) existing.canon = canon_of(existing.value);
+			if (existing.canon != canon) continue;
+
+			if (counts_dedup) Metrics::add(Metrics::DedupHits);
+			if (tag < existing.tag)
+			{
+				existing.tag = tag;
+				existing.value = std::move(value);
+			}
+			return;
+		}
+
+		index.emplace(hash, entries.size());
+		entries.push_back({ tag, hash, std::move(canon), std::move(value) });
+	}
+};
+
+
+// Concatenate per-worker buffers in tag order, keeping the first
+// occurrence of every isomorphism class. Entries whose hash shows up in
+// several buffers are canonized in parallel first.
+template <typename Tag, typename Value, typename F>
+std::vector<typename TaggedCanonBuffer<Tag, Value>::Entry> mergeTagged(
+	TaskScheduler& scheduler,
+	PerWorker<TaggedCanonBuffer<Tag, Value>>& buffers,
+	const F& canon_of)
+{
+	using Entry = typename TaggedCanonBuffer<Tag, Value>::Entry;
+
+	std::vector<Entry> merged;
+	std::unordered_map<uint64_t, size_t> hash_counts;
+	bool counts_dedup = buffers.slots.empty() || buffers.slots.front().value.counts_dedup;
+	for (auto& slot : buffers.slots)
+	{
+		for (auto& e : slot.value.entries)
+		{
+			hash_counts[e.hash]++;
+			merged.push_back(std::move(e));
+		}
+		slot.value.entries.clear();
+		slot.value.index.clear();
+	}
+
+	std::vector<size_t> missing;
+	for (auto i = 0; i < merged.size(); ++i)
+	{
+		if (merged[i].canon.empty() && hash_counts[merged[i].hash] > 1) missing.push_back(i);
+	}
+	parallelFor(scheduler, 0, missing.size(), [&](size_t k) {
+		auto& e = merged[missing[k]];
+		e.canon = canon_of(e.value);
+	});
+
+	std::sort(merged.begin(), merged.end(), [](const Entry& a, const Entry& b) {
+		return a.tag < b.tag;
+	});
+
+	std::vector<Entry> res;
+	std::unordered_map<std::string, bool> seen;
+	for (auto& e : merged)
+	{
+		if (hash_counts[e.hash] == 1 || seen.emplace(e.canon, true).second) res.push_back(std::move(e));
+		else if (counts_dedup) Metrics::add(Metrics::DedupHits);
+	}
+
+	return res;
+}
+
+};	// end of namespace
@@ -0,0 +1,117 @@
+#include "SubsetOrbits.h"
+#include "Canonizer.h"
+#include "GraphUtils.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <unordered_set>
+
+namespace Ram
+{
+
+SubsetOrbits::SubsetOrbits(size_t degree, std::vector<std::vector<int>> generators) noexcept
+	: degree(degree)
+	, generators(std::move(generators))
+{
+	assert(degree <= 64 && "SubsetOrbits() Failed: masks hold at most 64 points.");
+}
+
+
+uint64_t SubsetOrbits::image(const std::vector<int>& generator, uint64_t mask) const noexcept
+{
+	uint64_t res = 0;
+	while (mask)
+	{
+		auto v = std::countr_zero(mask);
+		res |= uint64_t(1) << generator[v];
+		mask &= mask - 1;
+	}
+
+	return res;
+}
+
+
+std::vector<std::vector<uint64_t>> SubsetOrbits::representatives(size_t max_size) const noexcept
+{
+	if (max_size > degree) max_size = degree;
+
+	std::vector<std::vector<uint64_t>> levels(max_size + 1);
+	levels[0].push_back(0);
+
+	std::unordered_set<uint64_t> seen;
+	std::vector<uint64_t> stack;
+	for (size_t k = 1; k <= max_size; ++k)
+	{
+		seen.clear();
+		for (auto rep : levels[k-1])
+		{
+			for (size_t v = 0; v < degree; ++v)
+			{
+				auto bit = uint64_t(1) << v;
+				if (rep & bit) continue;
+
+				auto mask = rep | bit;
+				if (!seen.insert(mask).second) continue;
+
+				// Walk the new orbit, keeping its smallest mask
+				auto smallest = mask;
+				stack.assign(1, mask);
+				while (!stack.empty())
+				{
+					auto m = stack.back();
+					stack.pop_back();
+					smallest = std::min(smallest, m);
+
+					for (const auto& gen : generators)
+					{
+						auto img = image(gen, m);
+						if (seen.insert(img).second) stack.push_back(img);
+					}
+				}
+
+				levels[k].push_back(smallest);
+			}
+		}
+
+		std::sort(levels[k].begin(), levels[k].end());
+	}
+
+	return levels;
+}
+
+
+std::vector<std::vector<int>> colorAutomorphismGenerators(
+	const EdgeColoredUndirectedGraph& g,
+	int symmetric_colors) noexcept
+{
+	auto generators = Canonizer::local().automorphisms(g).generators;
+
+	// An embedding of a renaming into g on all vertices is an isomorphism,
+	// and one per renaming is enough next to Aut(g)
+	auto renamings = getColorPermutations(g, symmetric_colors);
+	for (size_t i = 1; i < renamings.size(); ++i)
+	{
+		auto isos = embed(renamings[i], g);
+		if (isos.empty()) continue;
+		generators.emplace_back(isos[0].begin(), isos[0].end());
+	}
+
+	return generators;
+}
+
+
+std::vector<Vertex> maskVertices(uint64_t mask) noexcept
+{
+	std::vector<Vertex> vertices;
+	vertices.reserve(std::popcount(mask));
+	while (mask)
+	{
+		vertices.push_back(std::countr_zero(mask));
+		mask &= mask - 1;
+	}
+
+	return vertices;
+}
+
+};	// end of namespace
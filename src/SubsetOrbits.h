@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "EdgeColoredUndirectedGraph.h"
+
+namespace Ram
+{
+
+// Orbits of vertex subsets under a permutation group on at most 64 points.
+// Subsets are bitmasks (bit v for vertex v) and the group is given by
+// generators, each mapping v to gen[v].
+//
+// Representatives are built level by level: every orbit of (k+1)-subsets
+// holds an extension of some k-subset representative by one vertex, so only
+// those extensions are expanded, and each orbit is walked once through the
+// generators to find its smallest mask.
+struct SubsetOrbits
+{
+	size_t degree = 0;
+	std::vector<std::vector<int>> generators;
+
+	SubsetOrbits(size_t degree, std::vector<std::vector<int>> generators) noexcept;
+
+	uint64_t image(const std::vector<int>& generator, uint64_t mask) const noexcept;
+
+	// Smallest mask of every orbit of k-subsets, for k = 0..max_size, with
+	// each level sorted. Memory grows with the largest orbit union per level.
+	std::vector<std::vector<uint64_t>> representatives(size_t max_size) const noexcept;
+};
+
+
+// Generators of the permutations mapping g onto itself up to renaming colors
+// 1..symmetric_colors: Aut(g) plus one isomorphism from g to each color
+// renaming of g it is isomorphic to. Colors above symmetric_colors stay fixed.
+std::vector<std::vector<int>> colorAutomorphismGenerators(
+	const EdgeColoredUndirectedGraph& g,
+	int symmetric_colors = -1) noexcept;
+
+std::vector<Vertex> maskVertices(uint64_t mask) noexcept;
+
+};	// end of namespace
@@ -0,0 +1,117 @@
+#include "Trace.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace Ram
+{
+
+namespace Trace
+{
+
+std::atomic<bool> is_enabled { false };
+
+namespace
+{
+
+std::mutex registry_lock;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+
+std::atomic<Clock::rep> epoch { 0 };
+
+};	// end of anonymous namespace
+
+
+ThreadBuffer& local() noexcept
+{
+	thread_local ThreadBuffer* buffer = nullptr;
+	if (!buffer)
+	{
+		std::lock_guard<std::mutex> lk(registry_lock);
+		registry.emplace_back(std::make_unique<ThreadBuffer>());
+		buffer = registry.back().get();
+		buffer->tid = registry.size() - 1;
+		buffer->events.reserve(1 << 12);
+	}
+	return *buffer;
+}
+
+
+void setEnabled(bool enabled) noexcept
+{
+	if (enabled)
+	{
+		std::lock_guard<std::mutex> lk(registry_lock);
+		for (auto& buffer : registry) buffer->events.clear();
+		epoch.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+	}
+
+	is_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+int64_t now() noexcept
+{
+	auto elapsed = Clock::duration(
+		Clock::now().time_since_epoch().count() - epoch.load(std::memory_order_relaxed)
+	);
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+
+bool write(const std::filesystem::path& path)
+{
+	if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream out(path);
+	if (!out.is_open())
+	{
+		std::fprintf(stderr, "Cannot write trace to %s\n", path.c_str());
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lk(registry_lock);
+
+	// Timestamps are in microseconds
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	size_t num_events = 0;
+	for (const auto& buffer : registry)
+	{
+		if (buffer->events.empty()) continue;
+
+		if (!first) out << ",\n";
+		first = false;
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+			<< ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+
+		for (const auto& e : buffer->events)
+		{
+			out << ",\n{\"name\":\"" << e.name
+				<< "\",\"cat\":\"" << e.category
+				<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"ts\":" << e.start_ns / 1000.0
+				<< ",\"dur\":" << e.duration_ns / 1000.0
+				<< ",\"args\":{";
+			for (auto a = 0; a < Event::MaxArgs && e.arg_names[a]; ++a)
+			{
+				if (a > 0) out << ",";
+				out << "\"" << e.arg_names[a] << "\":" << e.arg_values[a];
+			}
+			out << "}}";
+		}
+		num_events += buffer->events.size();
+	}
+	out << "\n]}\n";
+
+	std::printf("Wrote %zu trace events to %s\n", num_events, path.c_str());
+	return true;
+}
+
+};	// end of namespace Trace
+
+};	// end of namespace
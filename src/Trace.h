@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace Ram
+{
+
+namespace Trace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// One completed span. Names must outlive the trace (string literals or
+// registered stage names), so recording never allocates a string.
+struct Event
+{
+	static constexpr size_t MaxArgs = 3;
+
+	const char* name;
+	const char* category;
+	int64_t start_ns;
+	int64_t duration_ns;
+	std::array<const char*, MaxArgs> arg_names {};
+	std::array<int64_t, MaxArgs> arg_values {};
+};
+
+
+// Span buffer owned by one thread. Only the owner appends, and buffers are
+// only read by write() once all workers have been joined, so recording
+// takes no lock; the registry lock is taken once per thread.
+struct ThreadBuffer
+{
+	int tid;
+	std::vector<Event> events;
+};
+
+extern std::atomic<bool> is_enabled;
+
+ThreadBuffer& local() noexcept;
+
+
+inline bool enabled() noexcept
+{
+	return is_enabled.load(std::memory_order_relaxed);
+}
+
+// Enabling also restarts the trace clock and drops recorded spans
+void setEnabled(bool enabled) noexcept;
+
+int64_t now() noexcept;
+
+
+// Records its lifetime as a complete ("X") event on the calling thread
+struct Span
+{
+	Event event {};
+	size_t num_args = 0;
+	bool active;
+
+	Span(const char* name, const char* category) noexcept
+		: active(enabled())
+	{
+		if (!active) return;
+		event.name = name;
+		event.category = category;
+		event.start_ns = now();
+	}
+
+	Span(const char* name, const char* category, const char* arg_name, int64_t arg_value) noexcept
+		: Span(name, category)
+	{
+		arg(arg_name, arg_value);
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+
+	void arg(const char* arg_name, int64_t arg_value) noexcept
+	{
+		if (!active || num_args >= Event::MaxArgs) return;
+		event.arg_names[num_args] = arg_name;
+		event.arg_values[num_args] = arg_value;
+		++num_args;
+	}
+
+	~Span() noexcept
+	{
+		if (!active) return;
+		event.duration_ns = now() - event.start_ns;
+		local().events.push_back(event);
+	}
+};
+
+
+// Write every recorded span as trace-event JSON (chrome://tracing, Perfetto)
+bool write(const std::filesystem::path& path);
+
+};	// end of namespace Trace
+
+};	// end of namespace
@@ -1,61 +1,58 @@
 #include "Utils.h"
 
-#include <algorithm>
-#include <numeric>
+#include <array>
+#include <cassert>
 
 namespace Ram
 {
 
-std::vector<std::vector<int>> permute(int n, int k) noexcept
+// Pascal's triangle up to row 63; C(63, 31) still fits in 64 bits
+static const auto binomials = []
 {
-	std::vector<std::vector<int>> res;
-	std::vector<int> items(n);
-	std::iota(items.begin(), items.end(), 0);
-
-	std::vector<int> combo;
-	std::vector<bool> select(n, false);
-	std::fill(select.begin(), select.begin() + k, true);
-
-	do
+	std::array<std::array<uint64_t, 64>, 64> table{};
+	for (auto n = 0; n < 64; ++n)
 	{
-		combo.clear();
-		for (auto i = 0; i < n; ++i)
+		table[n][0] = 1;
+		for (auto k = 1; k <= n; ++k)
 		{
-			if (select[i]) combo.emplace_back(items[i]);
+			table[n][k] = table[n-1][k-1] + table[n-1][k];
 		}
+	}
+	return table;
+}();
 
-		// generate all permutations of current combo
-		std::sort(combo.begin(), combo.end());
-		do
-		{
-			res.emplace_back(combo);
-		} while (std::next_permutation(combo.begin(), combo.end()));
-	} while (std::prev_permutation(select.begin(), select.end()));
-
-	return res;
+uint64_t binomial(int n, int k) noexcept
+{
+	assert(n < 64 && "binomial() Failed: n must be below 64.");
+	if (k < 0 || k > n) return 0;
+	return binomials[n][k];
 }
 
-std::vector<std::vector<int>> choose(int n, int k) noexcept
+uint64_t rankCombination(uint64_t mask) noexcept
 {
-	std::vector<std::vector<int>> res;
-	std::vector<int> items(n);
-	std::iota(items.begin(), items.end(), 0);
-
-	std::vector<int> combo;
-	std::vector<bool> select(n, false);
-	std::fill(select.begin(), select.begin() + k, true);
-
-	do
+	// Colex rank: sum of C(c_i, i+1) over the sorted elements c_i
+	uint64_t rank = 0;
+	for (auto i = 1; mask; ++i)
 	{
-		combo.clear();
-		for (auto i = 0; i < n; ++i)
-		{
-			if (select[i]) combo.emplace_back(items[i]);
-		}
-		res.emplace_back(combo);
-	} while (std::prev_permutation(select.begin(), select.end()));
+		rank += binomial(std::countr_zero(mask), i);
+		mask &= mask - 1;
+	}
+	return rank;
+}
 
-	return res;
+uint64_t unrankCombination(uint64_t rank, int k) noexcept
+{
+	// Largest element first: the biggest c with C(c, i) <= rank
+	uint64_t mask = 0;
+	auto c = 63;
+	for (auto i = k; i > 0; --i)
+	{
+		while (binomial(c, i) > rank) --c;
+		mask |= uint64_t(1) << c;
+		rank -= binomial(c, i);
+		--c;
+	}
+	return mask;
 }
 
 uint64_t numBitsInBinary(uint64_t num) noexcept
@@ -1,16 +1,121 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cstdint>
+#include <iterator>
 #include <vector>
 
 namespace Ram
 {
 
-std::vector<std::vector<int>> permute(int n, int k) noexcept;
+// n choose k, for n < 64
+uint64_t binomial(int n, int k) noexcept;
+
+// Position of a k-subset mask in increasing mask (colex) order, and back
+uint64_t rankCombination(uint64_t mask) noexcept;
+
+uint64_t unrankCombination(uint64_t rank, int k) noexcept;
+
+
+// k-subsets of {0..n-1} as bitmasks in increasing order, stepped with
+// Gosper's hack. A rank range [first, last) picks a slice, so workers can
+// split the subsets without materializing them.
+struct Combinations
+{
+	struct Iterator
+	{
+		uint64_t mask;
+		uint64_t remaining;
+
+		uint64_t operator*() const noexcept { return mask; }
+
+		Iterator& operator++() noexcept
+		{
+			if (--remaining > 0)
+			{
+				auto low = mask & -mask;
+				auto ripple = mask + low;
+				mask = (((ripple ^ mask) >> 2) / low) | ripple;
+			}
+			return *this;
+		}
+
+		bool operator==(std::default_sentinel_t) const noexcept { return remaining == 0; }
+	};
+
+	int n;
+	int k;
+	uint64_t first;
+	uint64_t last;
+
+	Combinations(int n, int k) noexcept
+		: Combinations(n, k, 0, binomial(n, k))
+	{}
+
+	Combinations(int n, int k, uint64_t first, uint64_t last) noexcept
+		: n(n), k(k), first(first), last(std::min(last, binomial(n, k)))
+	{}
+
+	uint64_t size() const noexcept { return (first < last) ? last - first : 0; }
+
+	Iterator begin() const noexcept { return { unrankCombination(first, k), size() }; }
+
+	std::default_sentinel_t end() const noexcept { return {}; }
+};
+
+
+// k-permutations of {0..n-1}: every k-subset in Combinations order, each in
+// all of its orders starting from sorted. The iterator reorders one buffer in
+// place and hands out a reference to it.
+struct Permutations
+{
+	struct Iterator
+	{
+		Combinations::Iterator combo;
+		std::vector<int> items;
+
+		const std::vector<int>& operator*() const noexcept { return items; }
+
+		Iterator& operator++() noexcept
+		{
+			if (std::next_permutation(items.begin(), items.end())) return *this;
+
+			// Orders of this subset exhausted, load the next one sorted
+			++combo;
+			if (combo != std::default_sentinel) load();
+			return *this;
+		}
+
+		bool operator==(std::default_sentinel_t) const noexcept { return combo == std::default_sentinel; }
+
+		void load() noexcept
+		{
+			items.clear();
+			for (auto mask = *combo; mask; mask &= mask - 1)
+			{
+				items.push_back(std::countr_zero(mask));
+			}
+		}
+	};
+
+	int n;
+	int k;
+
+	Permutations(int n, int k) noexcept : n(n), k(k) {}
+
+	Iterator begin() const noexcept
+	{
+		Iterator it{ Combinations(n, k).begin(), {} };
+		it.items.reserve(k);
+		if (it != std::default_sentinel) it.load();
+		return it;
+	}
+
+	std::default_sentinel_t end() const noexcept { return {}; }
+};
 
-std::vector<std::vector<int>> choose(int n, int k) noexcept;
 
 uint64_t numBitsInBinary(uint64_t num) noexcept;
 
 };	// end of namespace
-
@@ -0,0 +1,434 @@
+#include "k62.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Ram;
+
+//
+// Allocation counting
+//
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+namespace
+{
+
+std::atomic<uint64_t> num_allocations { 0 };
+
+};	// end of anonymous namespace
+
+void* operator new(size_t size)
+{
+	num_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+
+//
+// Harness
+//
+namespace
+{
+
+// Keep results observable so the optimizer cannot drop the kernel
+template <typename T>
+void doNotOptimize(const T& value) noexcept
+{
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct BenchResult
+{
+	std::string name;
+	uint64_t iterations;
+	double ns_per_op;
+	double allocs_per_op;
+
+	// Items processed per second, where one op may process several items
+	double items_per_sec;
+};
+
+std::string filter;
+double min_seconds = 0.5;
+std::vector<BenchResult> results;
+
+// Time fn until min_seconds have elapsed. items is how many units of work
+// (graphs, bytes, ...) one call processes, for the throughput column.
+template <typename F>
+void bench(const std::string& name, F&& fn, double items = 1)
+{
+	if (!filter.empty() && name.find(filter) == std::string::npos) return;
+
+	// Warm up caches and any lazily built state
+	doNotOptimize(fn());
+
+	uint64_t iterations = 0;
+	uint64_t batch = 1;
+	auto allocs_before = num_allocations.load();
+	auto start_time = std::chrono::steady_clock::now();
+	Timing::seconds elapsed {};
+	while (elapsed.count() < min_seconds)
+	{
+		for (auto i = 0; i < batch; ++i) doNotOptimize(fn());
+		iterations += batch;
+		batch *= 2;
+		elapsed = std::chrono::steady_clock::now() - start_time;
+	}
+	auto allocs = num_allocations.load() - allocs_before;
+
+	double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+	BenchResult res {
+		name,
+		iterations,
+		ns / iterations,
+		static_cast<double>(allocs) / iterations,
+		items * iterations / elapsed.count()
+	};
+	results.push_back(res);
+
+	std::printf(
+		"%-40s %12.0f ns/op %10.1f allocs/op %14.1f items/s\n",
+		res.name.c_str(),
+		res.ns_per_op,
+		res.allocs_per_op,
+		res.items_per_sec
+	);
+	std::fflush(stdout);
+}
+
+
+//
+// Inputs
+//
+
+// T with a 17th vertex marking the first k vertices, as in upsilon62_1
+EdgeColoredUndirectedGraph makeMarked(const EdgeColoredUndirectedGraph& t, int k) noexcept
+{
+	EdgeColoredUndirectedGraph g(17, 4);
+	for (auto i = 0; i < 16; ++i)
+		for (auto j = i+1; j < 16; ++j)
+			g.setEdge(i, j, t.getEdge(i, j));
+
+	for (auto v = 0; v < k; ++v) g.setEdge(16, v, 4);
+	return g;
+}
+
+// Random triangle-free partial coloring: each edge is colored with
+// probability density, using a color that closes no monochromatic triangle
+EdgeColoredUndirectedGraph makeRandomPartial(
+	size_t num_vertices,
+	Color max_color,
+	double density,
+	uint64_t seed) noexcept
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> coin(0, 1);
+	std::uniform_int_distribution<int> pick(1, max_color);
+
+	EdgeColoredUndirectedGraph g(num_vertices, max_color);
+	for (auto i = 0; i < num_vertices; ++i)
+	{
+		for (auto j = i+1; j < num_vertices; ++j)
+		{
+			if (coin(rng) > density) continue;
+
+			auto first = pick(rng);
+			for (auto k = 0; k < max_color; ++k)
+			{
+				Color c = (first - 1 + k) % max_color + 1;
+				bool closes_triangle = false;
+				for (auto w = 0; w < num_vertices && !closes_triangle; ++w)
+				{
+					if (w == i || w == j) continue;
+					closes_triangle = (g.getEdge(i, w) == c && g.getEdge(j, w) == c);
+				}
+
+				if (!closes_triangle)
+				{
+					g.setEdge(i, j, c);
+					break;
+				}
+			}
+		}
+	}
+
+	return g;
+}
+
+
+//
+// Checks
+//
+
+// Combinations must walk every k-subset once in increasing order, agree with
+// rankCombination/unrankCombination, and split into rank slices without gaps;
+// Permutations must give every k-permutation once
+bool checkCombinatorics() noexcept
+{
+	for (auto n = 0; n <= 16; ++n)
+	{
+		for (auto k = 0; k <= n; ++k)
+		{
+			uint64_t rank = 0;
+			uint64_t prev = 0;
+			for (auto mask : Combinations(n, k))
+			{
+				if ((rank > 0 && mask <= prev) ||
+					std::popcount(mask) != k ||
+					(mask >> n) != 0 ||
+					rankCombination(mask) != rank ||
+					unrankCombination(rank, k) != mask)
+				{
+					std::fprintf(stderr, "Combinations(%d, %d) is wrong at rank %zu\n", n, k, size_t(rank));
+					return false;
+				}
+				prev = mask;
+				++rank;
+			}
+
+			// Three slices cover the same subsets as one walk
+			auto total = binomial(n, k);
+			uint64_t sliced = 0;
+			for (uint64_t first = 0; first < total; first += total / 3 + 1)
+			{
+				for (auto mask : Combinations(n, k, first, first + total / 3 + 1))
+				{
+					if (rankCombination(mask) != sliced++) sliced = total + 1;
+				}
+			}
+
+			if (rank != total || sliced != total)
+			{
+				std::fprintf(stderr, "Combinations(%d, %d) gave %zu of %zu subsets\n", n, k, size_t(rank), size_t(total));
+				return false;
+			}
+		}
+	}
+
+	for (auto n = 0; n <= 6; ++n)
+	{
+		for (auto k = 0; k <= n; ++k)
+		{
+			std::set<std::vector<int>> seen;
+			for (const auto& items : Permutations(n, k))
+			{
+				std::set<int> distinct(items.begin(), items.end());
+				bool in_range = (distinct.empty() || *distinct.rbegin() < n);
+				if (items.size() != k || distinct.size() != k || !in_range || !seen.insert(items).second)
+				{
+					std::fprintf(stderr, "Permutations(%d, %d) repeats or breaks an order\n", n, k);
+					return false;
+				}
+			}
+
+			// n! / (n-k)!
+			uint64_t expected = 1;
+			for (auto i = n - k + 1; i <= n; ++i) expected *= i;
+			if (seen.size() != expected)
+			{
+				std::fprintf(stderr, "Permutations(%d, %d) gave %zu of %zu orders\n", n, k, seen.size(), size_t(expected));
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+};	// end of anonymous namespace
+
+
+int main(int argc, char **argv)
+{
+	std::filesystem::path upsilon_path;
+	for (auto i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--filter" && i+1 < argc) filter = argv[++i];
+		else if (arg == "--min-time" && i+1 < argc) min_seconds = std::atof(argv[++i]);
+		else if (arg == "--upsilon" && i+1 < argc) upsilon_path = argv[++i];
+		else
+		{
+			std::fprintf(
+				stderr,
+				"Usage: bench [--filter NAME] [--min-time SECONDS] [--upsilon FILE.adj]\n"
+			);
+			return 1;
+		}
+	}
+
+	if (!checkCombinatorics()) return 1;
+
+	// Representative inputs
+	auto t1 = make_T1();
+	auto t2 = make_T2();
+	auto t_perms = make_tperms();
+	auto marked = makeMarked(t1, 8);
+	auto partial_k62 = makeRandomPartial(62, 4, 0.5, 62);
+	auto dense_k62 = makeRandomPartial(62, 4, 0.95, 63);
+
+	std::vector<std::pair<std::string, EdgeColoredUndirectedGraph>> inputs = {
+		{ "T1", t1 },
+		{ "marked17", marked },
+		{ "partialK62", partial_k62 },
+		{ "denseK62", dense_k62 },
+	};
+
+	// Sample of real stage graphs when available
+	if (!upsilon_path.empty())
+	{
+		auto ups = loadBulkAdj(upsilon_path);
+		if (!ups.empty()) inputs.push_back({ "upsilon", ups[ups.size() / 2] });
+	}
+
+
+	// Isomorphism
+	for (const auto& [name, g] : inputs)
+	{
+		bench("canonize/" + name, [&] { return canonize(g); });
+		for (auto [backend, tag] : {
+			std::pair{ CanonBackend::Dense, "dense" },
+			std::pair{ CanonBackend::Sparse, "sparse" },
+			std::pair{ CanonBackend::Traces, "traces" } })
+		{
+			CanonSpec spec;
+			spec.backend = backend;
+			bench(std::string("canonize[") + tag + "]/" + name, [&] { return canonize(g, spec); });
+		}
+		bench("nautify/" + name, [&] { return nautify(g); });
+		bench("getColorPermutations/" + name, [&] { return getColorPermutations(g); });
+		bench("invariantHash/" + name, [&] { return invariantHash(g); });
+	}
+
+
+	// Embeddability of T1 neighborhoods into T1(c), T2(c)
+	for (auto c = 1; c <= 3; ++c)
+	{
+		auto neighborhood = getNeighborhood(t1, 0, c);
+		const auto& t1c = t_perms.at(1).at(c);
+		const auto& t2c = t_perms.at(2).at(c);
+		auto suffix = "/N" + std::to_string(c) + "(T1,0)";
+		bench("embed" + suffix + "->T1", [&] { return embed(neighborhood, t1c); });
+		bench("canEmbed" + suffix + "->T2", [&] { return canEmbed(neighborhood, t2c); });
+	}
+
+	auto k62_neighborhood = getNeighborhood(partial_k62, 0, 1);
+	bench("canEmbed/N1(partialK62,0)->T1", [&] {
+		return canEmbed(k62_neighborhood, t_perms.at(1).at(1));
+	});
+
+	std::vector<Vertex> k62_neighbors;
+	bench("canEmbed/view/N1(partialK62,0)->T1", [&] {
+		return canEmbed(neighborhoodView(partial_k62, k62_neighbors, 0, 1), t_perms.at(1).at(1));
+	});
+
+
+	// Coloring and neighborhood queries
+	std::vector<Vertex> neighbors;
+	for (const auto& [name, g] : inputs)
+	{
+		bench("isTriangleFree/" + name, [&] { return isTriangleFree(g); });
+		bench("ColorMasks/" + name, [&] { return ColorMasks(g); });
+		bench("isTriangleFree/masks/" + name, [&] { return isTriangleFree(ColorMasks(g)); });
+		bench("getNeighborhood/" + name, [&] { return getNeighborhood(g, 0, 1); });
+		bench("neighborhoodView/" + name, [&] {
+			return isFullyColored(neighborhoodView(g, neighbors, 0, 1));
+		});
+	}
+
+
+	// Subset enumeration, as in upsilon62_1 (16 vertices of T)
+	bench("Combinations/16c8", [&] {
+		uint64_t sum = 0;
+		for (auto mask : Combinations(16, 8)) sum += mask;
+		return sum;
+	}, binomial(16, 8));
+	bench("Combinations/slices8/16c8", [&] {
+		// One slice per worker, each starting from its unranked first subset
+		uint64_t sum = 0;
+		auto slice = binomial(16, 8) / 8 + 1;
+		for (uint64_t first = 0; first < binomial(16, 8); first += slice)
+		{
+			for (auto mask : Combinations(16, 8, first, first + slice)) sum += mask;
+		}
+		return sum;
+	}, binomial(16, 8));
+	bench("rankCombination/16c8", [&] {
+		uint64_t sum = 0;
+		for (auto mask : Combinations(16, 8)) sum += rankCombination(mask);
+		return sum;
+	}, binomial(16, 8));
+	bench("unrankCombination/16c8", [&] {
+		uint64_t sum = 0;
+		for (uint64_t r = 0; r < binomial(16, 8); ++r) sum += unrankCombination(r, 8);
+		return sum;
+	}, binomial(16, 8));
+	bench("Permutations/8p4", [&] {
+		uint64_t sum = 0;
+		for (const auto& items : Permutations(8, 4)) sum += items[0];
+		return sum;
+	}, 8 * 7 * 6 * 5);
+
+
+	// IO
+	for (const auto& [name, g] : inputs)
+	{
+		auto mc = getGraphMC(g);
+		bench("getGraphMC/" + name, [&] { return getGraphMC(g); });
+		bench("readMC/" + name, [&] { return readMC(mc); });
+	}
+
+	std::vector<EdgeColoredUndirectedGraph> bulk;
+	for (auto i = 0; i < 500; ++i)
+	{
+		bulk.push_back(t1);
+		bulk.push_back(t2);
+	}
+	std::stringstream adj_stream;
+	writeGraphsAdj(adj_stream, bulk);
+	auto adj_text = adj_stream.str();
+	bench("loadBulkAdj/1000xT", [&] {
+		std::stringstream ss(adj_text);
+		return loadBulkAdj(ss);
+	}, bulk.size());
+	bench("loadBulkAdj/bytes", [&] {
+		std::stringstream ss(adj_text);
+		return loadBulkAdj(ss);
+	}, adj_text.size());
+
+	return 0;
+}
@@ -1,14 +1,29 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 
 #define MAXN (62*4)
+#include "AutGroup.h"
+#include "Canonizer.h"
 #include "EdgeColoredUndirectedGraph.h"
+#include "ExternalDedup.h"
 #include "GraphUtils.h"
+#include "InvariantCanonSet.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Scheduler.h"
+#include "SubsetOrbits.h"
 #include "Utils.h"
 
 using namespace Ram;
@@ -27,51 +42,107 @@ inline std::vector<Vertex> getAttachingSet(const EdgeColoredUndirectedGraph& g)
 {
 	auto attach_u = g.num_vertices - 2;
 	auto attach_v = g.num_vertices - 1;
-	std::vector<Vertex> attaching_set;
-	for (auto v = 0; v < attach_u; ++v)
+	return maskVertices(colorNeighbors(g, attach_u, 4) & colorNeighbors(g, attach_v, 4));
+}
+
+// Spec that pins each of the given vertices in a cell of its own, so the
+// automorphism group nauty reports is their pointwise stabilizer
+inline CanonSpec stabilizerSpec(
+	const EdgeColoredUndirectedGraph& g,
+	const std::vector<Vertex>& fixed) noexcept
+{
+	CanonSpec spec;
+	spec.vertex_cells.assign(g.num_vertices, 0);
+	for (auto k = 0; k < fixed.size(); ++k) spec.vertex_cells[fixed[k]] = k + 1;
+	return spec;
+}
+
+// False when a generator of group maps the embedding of neighbors onto a
+// lexicographically smaller one. Every orbit of embeddings under the group
+// keeps its smallest member, so skipping the others loses no isomorphism
+// class. The group must map neighbors onto itself.
+inline bool isLexLeader(
+	const Embedding& emb,
+	const std::vector<Vertex>& neighbors,
+	const AutGroup& group) noexcept
+{
+	Embedding image(emb.size());
+	for (const auto& gen : group.generators)
 	{
-		if (g.getEdge(attach_u, v) == 4 && g.getEdge(attach_v, v) == 4)
+		for (auto i = 0; i < neighbors.size(); ++i)
 		{
-			attaching_set.push_back(v);
+			auto it = std::lower_bound(neighbors.begin(), neighbors.end(), gen[neighbors[i]]);
+			assert(it != neighbors.end() && *it == gen[neighbors[i]]
+				&& "isLexLeader() Failed: group does not fix the neighborhood."
+			);
+			image[it - neighbors.begin()] = emb[i];
 		}
+		if (image < emb) return false;
 	}
 
-	return attaching_set;
+	return true;
+}
+
+// Stage graphs are told apart up to renaming every color, color 4 included,
+// as the stages always have. Color 4 and the marker vertices need no cell of
+// their own: their color degrees differ from every vertex of T, so the vertex
+// invariants already split them off before nauty searches.
+inline CanonSpec k62CanonSpec() noexcept
+{
+	return {};
+}
+
+inline std::string canonizeStage(const EdgeColoredUndirectedGraph& g) noexcept
+{
+	return canonize(g, k62CanonSpec());
 }
 
-inline void upsilon62_1() noexcept
+
+inline std::vector<EdgeColoredUndirectedGraph> upsilon62_1(
+	const std::filesystem::path& write_path = "graphs/62/upsilon1.adj") noexcept
 {
 	std::vector<EdgeColoredUndirectedGraph> ts = { make_T1(), make_T2() };
 
 	std::vector<EdgeColoredUndirectedGraph> graphs;
-	std::vector<std::unordered_set<std::string>> canons(17);
+	InvariantCanonSet::Lookup lookup = [&](size_t i) -> const EdgeColoredUndirectedGraph& {
+		return graphs[i];
+	};
+	std::vector<InvariantCanonSet> canons(17, InvariantCanonSet(lookup, canonizeStage));
+
+	// Subsets in one orbit of T's automorphisms up to renaming colors 1..3
+	// give isomorphic marked graphs, so only the smallest subset of each
+	// orbit is marked and the canonical dedup merges whatever is left
+	std::vector<std::vector<std::vector<uint64_t>>> reps;
+	for (const auto& t : ts)
+	{
+		SubsetOrbits orbits(16, colorAutomorphismGenerators(t, 3));
+		reps.push_back(orbits.representatives(16));
+	}
 
-	// Create marked subset coloring for all possible subsets
 	for (auto k = 1; k <= 16; ++k)
 	{
-		for (const auto& combo : choose(16, k))
+		for (auto ti = 0; ti < ts.size(); ++ti)
 		{
-			for (const auto& t : ts)
+			const auto& t = ts[ti];
+			Metrics::add(Metrics::OrbitPrunes, binomial(16, k) - reps[ti][k].size());
+
+			for (auto mask : reps[ti][k])
 			{
 				// Create t with 17 vertices, 4 colors
-				EdgeColoredUndirectedGraph t_prime(17, 4);
+				EdgeColoredUndirectedGraph g(17, 4);
 				for (auto i = 0; i < 16; ++i)
 					for (auto j = i+1; j < 16; ++j)
-						t_prime.setEdge(i, j, t.getEdge(i, j));
+						g.setEdge(i, j, t.getEdge(i, j));
 
-				// Mark the subset
-				auto g = t_prime;
-				for (auto v_marked : combo)
+				// Mark the subset with color 4 edges to the 17th vertex
+				for (auto v_marked : maskVertices(mask))
 				{
-					// Create color 4 edge to 17th vertex
 					g.setEdge(16, v_marked, 4);
 				}
 
-				// Canonize
-				auto canon = canonize(g);
-				if (!canons[k].contains(canon))
+				// T1 and T2 still share the canonical dedup
+				if (canons[k].insert(g, graphs.size()))
 				{
-					canons[k].insert(canon);
 					graphs.push_back(g);
 				}
 			}
@@ -89,16 +160,22 @@ inline void upsilon62_1() noexcept
 		);
 	}
 
-	writeGraphsToFileAdj("graphs/62/upsilon1.adj", graphs);
+	if (!write_path.empty()) writeGraphsToFileAdj(write_path, graphs);
+	return graphs;
 }
 
 
-inline void upsilon62_2(const std::vector<EdgeColoredUndirectedGraph>& upsilon1) noexcept
+inline std::vector<EdgeColoredUndirectedGraph> upsilon62_2(
+	const std::vector<EdgeColoredUndirectedGraph>& upsilon1,
+	const std::filesystem::path& write_path = "graphs/62/upsilon2.adj") noexcept
 {
 	std::vector<EdgeColoredUndirectedGraph> ts = { make_T1(), make_T2() };
 
-	std::vector<std::unordered_set<std::string>> canons(17);
 	std::vector<EdgeColoredUndirectedGraph> graphs;
+	InvariantCanonSet::Lookup lookup = [&](size_t i) -> const EdgeColoredUndirectedGraph& {
+		return graphs[i];
+	};
+	std::vector<InvariantCanonSet> canons(17, InvariantCanonSet(lookup, canonizeStage));
 	int progress = 1;
 	for (const auto& g : upsilon1)
 	{
@@ -195,11 +272,9 @@ inline void upsilon62_2(const std::vector<EdgeColoredUndirectedGraph>& upsilon1)
 				{
 					overlap1.setEdge(i, v, 4);
 				}
-				// Canonize graph
-				auto canon = canonize(overlap1);
-				if (!canons[marked.size()].contains(canon))
+				// Canonize graph on invariant collisions
+				if (canons[marked.size()].insert(overlap1, graphs.size()))
 				{
-					canons[marked.size()].insert(canon);
 					graphs.emplace_back(std::move(overlap1));
 				}
 
@@ -214,11 +289,8 @@ inline void upsilon62_2(const std::vector<EdgeColoredUndirectedGraph>& upsilon1)
 				{
 					overlap2.setEdge(i, u, 4);
 				}
-				// Canonize graph
-				canon = canonize(overlap2);
-				if (!canons[marked.size()].contains(canon))
+				if (canons[marked.size()].insert(overlap2, graphs.size()))
 				{
-					canons[marked.size()].insert(canon);
 					graphs.emplace_back(std::move(overlap2));
 				}
 			}
@@ -238,11 +310,14 @@ inline void upsilon62_2(const std::vector<EdgeColoredUndirectedGraph>& upsilon1)
 	}
 
 	// Save graphs
-	writeGraphsToFileAdj("graphs/62/upsilon2.adj", graphs);
+	if (!write_path.empty()) writeGraphsToFileAdj(write_path, graphs);
+	return graphs;
 }
 
 
-inline void upsilon62_3(const std::vector<EdgeColoredUndirectedGraph>& upsilon2) noexcept
+inline std::vector<EdgeColoredUndirectedGraph> upsilon62_3(
+	const std::vector<EdgeColoredUndirectedGraph>& upsilon2,
+	const std::filesystem::path& write_path = "graphs/62/upsilon3.adj") noexcept
 {
 	std::vector<EdgeColoredUndirectedGraph> ts = { make_T1(), make_T2() };
 
@@ -259,13 +334,14 @@ inline void upsilon62_3(const std::vector<EdgeColoredUndirectedGraph>& upsilon2)
 		// Make sure each vertex in the attaching set is
 		// embeddable into a good k16 for at least 2 colors
 		bool is_embeddable = true;
+		std::vector<Vertex> neighbors;
 		for (auto u : attaching_set)
 		{
 			int num_embeddable_neighborhoods = 0;
 			for (Color c = 1; c <= 3; ++c)
 			{
 				// Get neighbood of u in color c
-				auto neighborhood = getNeighborhood(g, u, c);
+				auto neighborhood = neighborhoodView(g, neighbors, u, c);
 
 				// Check if neighborhood is embeddable into a good k16
 				for (const auto& t : ts)
@@ -320,7 +396,8 @@ inline void upsilon62_3(const std::vector<EdgeColoredUndirectedGraph>& upsilon2)
 	std::printf("%zu remaining graphs\n", graphs.size());
 
 	// Save Graphs
-	writeGraphsToFileAdj("graphs/62/upsilon3.adj", graphs);
+	if (!write_path.empty()) writeGraphsToFileAdj(write_path, graphs);
+	return graphs;
 }
 
 
@@ -357,139 +434,203 @@ make_tperms() noexcept
 	return t_perms;
 }
 
-inline int countFullyColoredNeighborhoods(const EdgeColoredUndirectedGraph& g, Vertex v, Color max_color) noexcept
+inline int countFullyColoredNeighborhoods(const ColorMasks& masks, Vertex v, Color max_color) noexcept
 {
 	auto cnt = 0;
-	for (auto c = 1; c <= max_color; ++c)
+	for (Color c = 1; c <= max_color; ++c)
 	{
-		bool is_colored = true;
-		auto n = getNeighborhood(g, v, c);
-		for (auto i = 0; i < n.num_vertices; ++i)
-		{
-			for (auto j = i+1; j < n.num_vertices; ++j)
-			{
-				auto ec = n.getEdge(i, j);
-				if (ec == 0)
-				{
-					is_colored = false;
-					break;
-				}
-			}
-
-			if (!is_colored) break;
-		}
-
-		if (is_colored) ++cnt;
+		if (masks.isFullyColored(masks.neighbors(v, c))) ++cnt;
 	}
 
 	return cnt;
 }
 
 
-inline void upsilon62_4(
-	const std::vector<EdgeColoredUndirectedGraph>& upsilon3,
-	std::filesystem::path write_path = "graphs/62/upsilon4.adj") noexcept
+// True if N_c(x) embeds into T1(c) or T2(c) for at least two colors c
+inline bool hasEmbeddableNeighborhoods(
+	const EdgeColoredUndirectedGraph& g,
+	Vertex x,
+	const std::unordered_map<int, std::unordered_map<int, EdgeColoredUndirectedGraph>>& t_perms,
+	std::vector<Vertex>& neighbors) noexcept
 {
-	auto t_perms = make_tperms();
-	std::vector<EdgeColoredUndirectedGraph> pullbacks;
-	for (const auto& g : upsilon3)
+	int num_embeddable_neighborhoods = 0;
+	for (auto c = 1; c <= 3; ++c)
 	{
+		// Build neighborhood
+		auto neighborhood = neighborhoodView(g, neighbors, x, c);
+		if (canEmbed(neighborhood, t_perms.at(1).at(c)) ||
+			canEmbed(neighborhood, t_perms.at(2).at(c)))
+		{
+			++num_embeddable_neighborhoods;
+		}
+	}
+
+	return num_embeddable_neighborhoods >= 2;
+}
+
+
+// Keep graphs whose attaching vertices each have neighborhoods embeddable
+// into T1(c) or T2(c) for at least two colors c
+inline std::vector<char> filterEmbeddable(
+	TaskScheduler& scheduler,
+	const std::vector<EdgeColoredUndirectedGraph>& gs,
+	const std::unordered_map<int, std::unordered_map<int, EdgeColoredUndirectedGraph>>& t_perms,
+	size_t min_order,
+	size_t max_order) noexcept
+{
+	std::vector<char> is_good(gs.size(), false);
+	parallelFor(scheduler, 0, gs.size(), [&](size_t gi) {
+		const auto& g = gs[gi];
+
 		// Build attaching set
 		auto attaching_set = getAttachingSet(g);
-		if (attaching_set.size() < 2 || attaching_set.size() > 15) continue;
+		if (attaching_set.size() < min_order || attaching_set.size() > max_order) return;
 
-		bool is_good = true;
+		std::vector<Vertex> neighbors;
 		for (auto x : attaching_set)
 		{
-			int num_embeddable_neighborhoods = 0;
-			for (auto c = 1; c <= 3; ++c)
-			{
-				// Build neighborhood
-				auto neighborhood = getNeighborhood(g, x, c);
-				if (canEmbed(neighborhood, t_perms[1].at(c)) ||
-					canEmbed(neighborhood, t_perms[2].at(c)))
-				{
-					++num_embeddable_neighborhoods;
-				}
-			}
-
-			if (num_embeddable_neighborhoods < 2)
-			{
-				is_good = false;
-				break;
-			}
+			if (!hasEmbeddableNeighborhoods(g, x, t_perms, neighbors)) return;
 		}
 
-		if (is_good)
-		{
-			pullbacks.push_back(g);
-		}
-	}
+		is_good[gi] = true;
+	});
 
-	std::printf("%zu pullbacks found\n", pullbacks.size());
+	return is_good;
+}
 
 
-	// Pull back graphs
-	std::vector<EdgeColoredUndirectedGraph> graphs;
-	std::unordered_set<std::string> canons;
-	std::vector<int> attaching_orders(17, 0);
-	int progress = 1;
-	for (const auto& g : pullbacks)
-	{
-		// Get first vertex of attaching set
+// With external dedup and a write_path, the distinct graphs are merged into
+// write_path and not returned, so the stage output is never held in memory
+inline std::vector<EdgeColoredUndirectedGraph> upsilon62_4(
+	const std::vector<EdgeColoredUndirectedGraph>& upsilon3,
+	const std::filesystem::path& write_path = "graphs/62/upsilon4.adj",
+	const DedupOptions& dedup = {},
+	int num_threads = 1) noexcept
+{
+	const auto t_perms = make_tperms();
+	TaskScheduler scheduler(num_threads);
+
+	// Pull back graphs. Each result is tagged with (graph, color, T, embedding)
+	// so the merged output has the same order as a sequential run.
+	using Tag = std::array<size_t, 4>;
+	PerWorker<TaggedCanonBuffer<Tag, EdgeColoredUndirectedGraph>> buffers(scheduler);
+
+	// External dedup spools from every worker; its order is not deterministic
+	std::unique_ptr<ExternalDedup> external;
+	std::mutex external_lock;
+	if (dedup.external) external = std::make_unique<ExternalDedup>(dedup);
+
+	// Filter and pull back in one pass. The embeddings of the first attaching
+	// vertex's neighborhoods decide its part of the filter and are then
+	// pulled back, so they are only searched for once.
+	std::atomic<int> progress = 1;
+	std::atomic<size_t> num_pullbacks = 0;
+	parallelFor(scheduler, 0, upsilon3.size(), [&](size_t gi) {
+		const auto& g = upsilon3[gi];
+
 		auto attaching_set = getAttachingSet(g);
+		if (attaching_set.size() < 2 || attaching_set.size() > 15) return;
+
+		// Cheaper canEmbed checks on the other attaching vertices first
+		std::array<std::vector<Vertex>, 3> neighbors;
+		for (auto xi = 1; xi < attaching_set.size(); ++xi)
+		{
+			if (!hasEmbeddableNeighborhoods(g, attaching_set[xi], t_perms, neighbors[0])) return;
+		}
+
+		// Get embeddings of neighborhoods of the first vertex into T1(c) and T2(c)
 		Vertex v_extend = attaching_set[0];
-		// Vertex v_extend = attaching_set.back();
-		
-		// Get embeddings of neighborhoods into T1(c) and T2(c)
+		std::array<std::vector<Embedding>, 6> embeddings;
+		int num_embeddable_neighborhoods = 0;
 		for (auto c = 1; c <= 3; ++c)
 		{
-			// Build neighborhood
-			std::vector<Vertex> neighbors;
-			auto neighborhood = getNeighborhood(g, neighbors, v_extend, c);
+			auto neighborhood = neighborhoodView(g, neighbors[c-1], v_extend, c);
+			auto& emb1 = embeddings[(c-1) * 2];
+			auto& emb2 = embeddings[(c-1) * 2 + 1];
+			emb1 = embed(neighborhood, t_perms.at(1).at(c));
+			emb2 = embed(neighborhood, t_perms.at(2).at(c));
+			if (!emb1.empty() || !emb2.empty()) ++num_embeddable_neighborhoods;
+		}
+		if (num_embeddable_neighborhoods < 2) return;
 
-			// Embed
-			std::vector<EdgeColoredUndirectedGraph> ts = { t_perms[1].at(c), t_perms[2].at(c) };
-			for (const auto& t : ts)
-			{
-				auto embeddings = embed(neighborhood, t);
-				for (const auto& emb : embeddings)
+		++num_pullbacks;
+		Trace::Span graph_span("graph", "upsilon62_4", "graph", gi);
+
+		parallelFor(scheduler, 0, 6, [&](size_t ct) {
+			auto c = ct / 2 + 1;
+			auto t_idx = ct % 2 + 1;
+			const auto& t = t_perms.at(t_idx).at(c);
+			const auto& c_neighbors = neighbors[c-1];
+
+			parallelFor(scheduler, 0, embeddings[ct].size(), [&](size_t ei) {
+				const auto& emb = embeddings[ct][ei];
+
+				// Pull back embedding
+				auto partial = g;
+				for (auto i = 0; i < c_neighbors.size(); ++i)
 				{
-					// Pull back embedding
-					auto partial = g;
-					for (auto i = 0; i < neighbors.size(); ++i)
+					auto u = c_neighbors[i];
+					for (auto j = i+1; j < c_neighbors.size(); ++j)
 					{
-						auto u = neighbors[i];
-						for (auto j = i+1; j < neighbors.size(); ++j)
+						auto v = c_neighbors[j];
+						if (!partial.hasEdge(u, v))
 						{
-							auto v = neighbors[j];
-							if (!partial.hasEdge(u, v))
-							{
-								auto ec = t.getEdge(emb[i], emb[j]);
-								partial.setEdge(u, v, ec);
-							}
+							auto ec = t.getEdge(emb[i], emb[j]);
+							partial.setEdge(u, v, ec);
 						}
 					}
+				}
 
-					// Check if fully colored in one neighborhood of first attaching vertex
-					if (countFullyColoredNeighborhoods(partial, v_extend, 3) < 1) continue;
+				// Check if fully colored in one neighborhood of first attaching vertex
+				ColorMasks masks(partial);
+				if (countFullyColoredNeighborhoods(masks, v_extend, 3) < 1) return;
 
-					// Check if triangle-free
-					if (!isTriangleFree(partial)) continue;
+				// Check if triangle-free
+				if (!isTriangleFree(masks)) return;
 
-					// Check if non-isomorhpic
-					auto canon = canonize(partial);
-					if (!canons.contains(canon))
-					{
-						canons.insert(canon);
-						graphs.emplace_back(std::move(partial));
-						attaching_orders[attaching_set.size()]++;
-					}
+				// Check if non-isomorhpic
+				if (external)
+				{
+					auto canon = canonizeStage(partial);
+					std::lock_guard<std::mutex> lk(external_lock);
+					external->add(canon, partial);
 				}
-			}
-		}
+				else
+				{
+					Tag tag = { gi, c, t_idx, ei };
+					auto hash = invariantHash(partial);
+					buffers.local().insert(tag, hash, "", std::move(partial), canonizeStage);
+				}
+			});
+		});
 
 		std::printf("Finished g%d\n", progress++);
+	});
+
+	std::printf("%zu pullbacks found\n", num_pullbacks.load());
+
+	// Merge thread-local results
+	std::vector<EdgeColoredUndirectedGraph> graphs;
+	std::vector<int> attaching_orders(17, 0);
+	size_t num_distinct = 0;
+	if (external)
+	{
+		// Merge spilled runs straight into write_path; only without one are
+		// the distinct graphs collected in memory
+		bool keep_graphs = write_path.empty();
+		num_distinct = external->finish(write_path, [&](const EdgeColoredUndirectedGraph& g) {
+			attaching_orders[getAttachingSet(g).size()]++;
+			if (keep_graphs) graphs.push_back(g);
+		});
+	}
+	else
+	{
+		for (auto& e : mergeTagged(scheduler, buffers, canonizeStage))
+		{
+			attaching_orders[getAttachingSet(e.value).size()]++;
+			graphs.emplace_back(std::move(e.value));
+		}
+		num_distinct = graphs.size();
 	}
 
 
@@ -497,56 +638,37 @@ inline void upsilon62_4(
 	{
 		std::printf("Attaching Set Order %d: %d\n", i, attaching_orders[i]);
 	}
-	std::printf("Found %zu partial colorings extended by one vertex\n", canons.size());
+	std::printf("Found %zu partial colorings extended by one vertex\n", num_distinct);
 
 	// Save to file
-	writeGraphsToFileAdj(write_path, graphs);
+	if (!external && !write_path.empty()) writeGraphsToFileAdj(write_path, graphs);
+	return graphs;
 }
 
 
-inline void upsilon62_5(
+// Writes its output like upsilon62_4. Without prune_orbits every embedding of
+// N_c(x) is pulled back, and max_steps stops after that many attaching
+// vertices of each graph; the regression run uses both to compare pruning on
+// partials that are not yet culled.
+inline std::vector<EdgeColoredUndirectedGraph> upsilon62_5(
 	const std::vector<EdgeColoredUndirectedGraph>& upsilon4,
-	std::filesystem::path write_path = "graphs/62/upsilon5.adj") noexcept
+	const std::filesystem::path& write_path = "graphs/62/upsilon5.adj",
+	const DedupOptions& dedup = {},
+	int num_threads = 1,
+	bool prune_orbits = true,
+	size_t max_steps = SIZE_MAX) noexcept
 {
-	auto t_perms = make_tperms();
+	assert(max_steps > 0 && "upsilon62_5() Failed: no attaching vertex to extend.");
+
+	const auto t_perms = make_tperms();
+	TaskScheduler scheduler(num_threads);
 
 	// Cull colorings that are not embeddable in two colors
-	std::vector<EdgeColoredUndirectedGraph> embeddable;
-	for (const auto& g : upsilon4)
+	auto is_embeddable = filterEmbeddable(scheduler, upsilon4, t_perms, 0, 16);
+	std::vector<size_t> embeddable;
+	for (auto i = 0; i < upsilon4.size(); ++i)
 	{
-		// Find the attaching set of u and v
-		auto attaching_set = getAttachingSet(g);
-
-		// Check each vertex in attaching set for embeddability
-		bool is_good = true;
-		for (auto x : attaching_set)
-		{
-			auto num_embeddable_colors = 0;
-			for (auto c = 1; c <= 3; ++c)
-			{
-				std::vector<EdgeColoredUndirectedGraph> ts = { t_perms[1].at(c), t_perms[2].at(c) };
-				auto neighborhood = getNeighborhood(g, x, c);
-				for (const auto& t : ts)
-				{
-					if (canEmbed(neighborhood, t))
-					{
-						++num_embeddable_colors;
-						break;
-					}
-				}
-			}
-
-			if (num_embeddable_colors < 2)
-			{
-				is_good = false;
-				break;
-			}
-		}
-
-		if (is_good)
-		{
-			embeddable.push_back(g);
-		}
+		if (is_embeddable[i]) embeddable.push_back(i);
 	}
 
 	std::printf("%zu graphs are embeddable in two colors\n", embeddable.size());
@@ -557,117 +679,203 @@ inline void upsilon62_5(
 		{ 1, 3 },
 		{ 2, 3 }
 	};
-	std::vector<EdgeColoredUndirectedGraph> graphs;
-	std::unordered_set<std::string> canons;
-	std::vector<int> attaching_orders(17, 0);
-	int progress = 1;
-	for (const auto& g : embeddable)
-	{
+
+	// Results are tagged with (graph, partial) across graphs, and with
+	// (color pair, previous partial, Tc, c-embedding, Td, d-embedding)
+	// within one attaching vertex step
+	using OutTag = std::array<size_t, 2>;
+	using StepTag = std::array<size_t, 6>;
+	PerWorker<TaggedCanonBuffer<OutTag, EdgeColoredUndirectedGraph>> buffers(scheduler);
+
+	// External dedup spools from every worker; its order is not deterministic
+	std::unique_ptr<ExternalDedup> external;
+	std::mutex external_lock;
+	if (dedup.external) external = std::make_unique<ExternalDedup>(dedup);
+
+	std::atomic<int> progress = 1;
+	parallelFor(scheduler, 0, embeddable.size(), [&](size_t gi) {
+		const auto& g = upsilon4[embeddable[gi]];
+
 		// Build attaching set
 		auto attaching_set = getAttachingSet(g);
 
-		if (attaching_set.size() < 3 || attaching_set.size() > 14) continue;
+		if (attaching_set.size() < 3 || attaching_set.size() > 14) return;
+
+		Trace::Span graph_span("graph", "upsilon62_5", "graph", embeddable[gi]);
+		graph_span.arg("attaching", attaching_set.size());
 
 		std::vector<EdgeColoredUndirectedGraph> partials = { g };
-		for (auto x : attaching_set)
+		std::vector<uint64_t> partial_hashes;
+		std::vector<std::string> partial_canons;
+		auto num_steps = std::min(attaching_set.size(), max_steps);
+		for (auto xi = 0; xi < num_steps; ++xi)
 		{
-			// Overlap all good embeddings of current vertex onto previous pullbacks
-			std::vector<EdgeColoredUndirectedGraph> new_partials;
-			std::unordered_set<std::string> new_canons;
-			for (auto [ci, di] : color_pairs)
-			{
-				for (const auto& prev_partial : partials)
-				{
-					std::vector<Vertex> c_neighbors;
-					auto c_neighborhood = getNeighborhood(prev_partial, c_neighbors, x, ci);
+			auto x = attaching_set[xi];
+
+			// Automorphisms of each previous partial fixing u, v, x and every
+			// attaching vertex after x. They map N_c(x) onto itself, embeddings
+			// related by them pull back to isomorphic partials, and the later
+			// steps see the same vertices in the same order on both.
+			std::vector<Vertex> fixed = { g.num_vertices - 2, g.num_vertices - 1 };
+			fixed.insert(fixed.end(), attaching_set.begin() + xi, attaching_set.end());
+			std::vector<AutGroup> stabilizers(prune_orbits ? partials.size() : 0);
+			parallelFor(scheduler, 0, stabilizers.size(), [&](size_t pi) {
+				auto spec = stabilizerSpec(partials[pi], fixed);
+				stabilizers[pi] = Canonizer::local().automorphisms(partials[pi], spec);
+			});
+
+			// Overlap all good embeddings of current vertex onto previous
+			// pullbacks. Step results reach the outer buffers, which count the
+			// dedup.
+			PerWorker<TaggedCanonBuffer<StepTag, EdgeColoredUndirectedGraph>> step(scheduler);
+			for (auto& slot : step.slots) slot.value.counts_dedup = false;
+
+			// One task per (color pair, previous partial, Tc)
+			auto num_items = color_pairs.size() * partials.size() * 2;
+			parallelFor(scheduler, 0, num_items, [&](size_t item) {
+				auto pair_idx = item / (partials.size() * 2);
+				auto prev_idx = (item / 2) % partials.size();
+				auto kc = item % 2 + 1;
+				auto [ci, di] = color_pairs[pair_idx];
+				const auto& prev_partial = partials[prev_idx];
+
+				Trace::Span pair_span("color pair", "upsilon62_5", "c", ci);
+				pair_span.arg("d", di);
+				pair_span.arg("T", kc);
+
+				std::vector<Vertex> c_neighbors;
+				auto c_neighborhood = neighborhoodView(prev_partial, c_neighbors, x, ci);
+
+				// Embed N_ci(x) in ts
+				const auto& tc = t_perms.at(kc).at(ci);
+				auto c_embeddings = embed(c_neighborhood, tc);
+				parallelFor(scheduler, 0, c_embeddings.size(), [&](size_t ce) {
+					const auto& c_embed = c_embeddings[ce];
+					if (prune_orbits && !isLexLeader(c_embed, c_neighbors, stabilizers[prev_idx]))
+					{
+						Metrics::add(Metrics::OrbitPrunes);
+						return;
+					}
 
-					// Embed N_ci(x) in ts
-					for (auto kc = 1; kc <= 2; ++kc)
+					// Pull back onto N_c(x)
+					auto partial_c = prev_partial;
+					for (auto i = 0; i < c_neighbors.size(); ++i)
 					{
-						auto& tc = t_perms[kc].at(ci);
-						if (!canEmbed(c_neighborhood, tc)) continue;
+						for (auto j = i+1; j < c_neighbors.size(); ++j)
+						{
+							auto u = c_neighbors[i];
+							auto v = c_neighbors[j];
+
+							if (!partial_c.hasEdge(u, v))
+							{
+								auto ec = tc.getEdge(c_embed[i], c_embed[j]);
+								partial_c.setEdge(u, v, ec);
+							}
+						}
+					}
 
-						for (auto c_embed : embed(c_neighborhood, tc))
+					// Now overlap with pull back of N_d(x) over ts
+					std::vector<Vertex> d_neighbors;
+					auto d_neighborhood = neighborhoodView(partial_c, d_neighbors, x, di);
+					for (auto kd = 1; kd <= 2; ++kd)
+					{
+						const auto& td = t_perms.at(kd).at(di);
+						auto d_embeddings = embed(d_neighborhood, td);
+						for (auto de = 0; de < d_embeddings.size(); ++de)
 						{
-							// Pull back onto N_c(x)
-							auto partial_c = prev_partial;
-							for (auto i = 0; i < c_neighbors.size(); ++i)
+							const auto& d_embed = d_embeddings[de];
+							auto partial_d = partial_c;
+							for (auto i = 0; i < d_neighbors.size(); ++i)
 							{
-								for (auto j = i+1; j < c_neighbors.size(); ++j)
+								for (auto j = i+1; j < d_neighbors.size(); ++j)
 								{
-									auto u = c_neighbors[i];
-									auto v = c_neighbors[j];
+									auto u = d_neighbors[i];
+									auto v = d_neighbors[j];
 
-									if (!partial_c.hasEdge(u, v))
+									if (!partial_d.hasEdge(u, v))
 									{
-										auto ec = tc.getEdge(c_embed[i], c_embed[j]);
-										partial_c.setEdge(u, v, ec);
+										auto ec = td.getEdge(d_embed[i], d_embed[j]);
+										partial_d.setEdge(u, v, ec);
 									}
 								}
 							}
 
-							// Now overlap with pull back of N_d(x) over ts
-							std::vector<Vertex> d_neighbors;
-							auto d_neighborhood = getNeighborhood(partial_c, d_neighbors, x, di);
-							for (auto kd = 1; kd <= 2; ++kd)
-							{
-								auto& td = t_perms[kd].at(di);
-								if (!canEmbed(d_neighborhood, td)) continue;
-
-								for (auto d_embed : embed(d_neighborhood, td))
-								{
-									auto partial_d = partial_c;
-									for (auto i = 0; i < d_neighbors.size(); ++i)
-									{
-										for (auto j = i+1; j < d_neighbors.size(); ++j)
-										{
-											auto u = d_neighbors[i];
-											auto v = d_neighbors[j];
-
-											if (!partial_d.hasEdge(u, v))
-											{
-												auto ec = td.getEdge(d_embed[i], d_embed[j]);
-												partial_d.setEdge(u, v, ec);
-											}
-										}
-									}
 
+							// Check if partial colorings is triangle-free
+							if (!isTriangleFree(ColorMasks(partial_d))) continue;
 
-									// Check if partial colorings is triangle-free
-									if (!isTriangleFree(partial_d)) continue;
-
-									// Canonize
-									auto canon = canonize(partial_d);
-									if (!new_canons.contains(canon))
-									{
-										new_partials.emplace_back(std::move(partial_d));
-										new_canons.insert(canon);
-									}
-								}
-							}
+							// Canonize
+							StepTag tag = { 
+								pair_idx, prev_idx, kc, ce, 
+								static_cast<size_t>(kd), static_cast<size_t>(de) 
+							};
+							auto hash = invariantHash(partial_d);
+							step.local().insert(tag, hash, "", std::move(partial_d), canonizeStage);
 						}
 					}
-
-				}
-			}
+				});
+			});
 
 			// Partials now overlap in neighborhoods of current vertex
-			partials = new_partials;
+			partials.clear();
+			partial_hashes.clear();
+			partial_canons.clear();
+			for (auto& e : mergeTagged(scheduler, step, canonizeStage))
+			{
+				partials.emplace_back(std::move(e.value));
+				partial_hashes.push_back(e.hash);
+				partial_canons.emplace_back(std::move(e.canon));
+			}
 		}
 
-		// Canonize new partial colorings
-		for (const auto& partial : partials)
+		// Keep new partial colorings, reusing hashes and any canonical forms
+		// from the last step
+		for (auto pi = 0; pi < partials.size(); ++pi)
 		{
-			auto canon = canonize(partial);
-			if (!canons.contains(canon))
+			if (external)
+			{
+				if (partial_canons[pi].empty()) partial_canons[pi] = canonizeStage(partials[pi]);
+				std::lock_guard<std::mutex> lk(external_lock);
+				external->add(partial_canons[pi], partials[pi]);
+			}
+			else
 			{
-				graphs.emplace_back(partial);
-				canons.insert(canon);
-				attaching_orders[attaching_set.size()]++;
+				OutTag tag = { gi, static_cast<size_t>(pi) };
+				buffers.local().insert(
+					tag,
+					partial_hashes[pi],
+					std::move(partial_canons[pi]),
+					std::move(partials[pi]),
+					canonizeStage
+				);
 			}
 		}
 
 		std::printf("Finished g%d\n", progress++);
+	});
+
+	// Merge thread-local results
+	std::vector<EdgeColoredUndirectedGraph> graphs;
+	std::vector<int> attaching_orders(17, 0);
+	size_t num_distinct = 0;
+	if (external)
+	{
+		// Merge spilled runs straight into write_path; only without one are
+		// the distinct graphs collected in memory
+		bool keep_graphs = write_path.empty();
+		num_distinct = external->finish(write_path, [&](const EdgeColoredUndirectedGraph& g) {
+			attaching_orders[getAttachingSet(g).size()]++;
+			if (keep_graphs) graphs.push_back(g);
+		});
+	}
+	else
+	{
+		for (auto& e : mergeTagged(scheduler, buffers, canonizeStage))
+		{
+			attaching_orders[getAttachingSet(e.value).size()]++;
+			graphs.emplace_back(std::move(e.value));
+		}
+		num_distinct = graphs.size();
 	}
 
 	
@@ -676,9 +884,9 @@ inline void upsilon62_5(
 	{
 		std::printf("Attaching Set Order %d: %d graphs\n", i, attaching_orders[i]);
 	}
-	std::printf("Found %zu graphs\n", canons.size());
+	std::printf("Found %zu graphs\n", num_distinct);
 
 	// Save to File
-	writeGraphsToFileAdj(write_path, graphs);
+	if (!external && !write_path.empty()) writeGraphsToFileAdj(write_path, graphs);
+	return graphs;
 }
-
@@ -1,7 +1,19 @@
-// #include "k62.h"
-#include "k60.h"
+#include "k62.h"
+#include "CanonIndex.h"
+#include "CanonicalAugmentation.h"
+#include "Canonizer.h"
+#include "Metrics.h"
+#include "Pipeline.h"
+#include "Regression.h"
+#include "Trace.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <map>
+#include <string>
 #include <vector>
 
 using namespace Ram;
@@ -11,15 +23,10 @@ bool isIsomorphicSubset(
 	const std::vector<EdgeColoredUndirectedGraph>& gs_a,
 	const std::vector<EdgeColoredUndirectedGraph>& gs_b) noexcept
 {
-	std::unordered_set<std::string> isomorphs;
-	for (const auto& a : gs_a)
-	{
-		isomorphs.insert(canonize(a));
-	}
-
+	auto isomorphs = CanonIndex::fromGraphs(gs_a);
 	for (const auto& b : gs_b)
 	{
-		if (!isomorphs.contains(canonize(b)))
+		if (!isomorphs.contains(b))
 		{
 			return false;
 		}
@@ -172,23 +179,10 @@ void countGoodNeighborhoods(
 		auto aset = getAttachingSet(g);
 
 		auto good = 0;
-		for (auto c = 1; c <= num_colors; ++c)
+		ColorMasks masks(g);
+		for (Color c = 1; c <= num_colors; ++c)
 		{
-			auto n = getNeighborhood(g, aset[0], c);
-			bool is_good = true;
-			for (auto i = 0; i < n.num_vertices; ++i)
-			{
-				for (auto j = i+1; j < n.num_vertices; ++j)
-				{
-					auto ec = n.getEdge(i, j);
-					if (ec == 0) 
-					{
-						is_good = false;
-					}
-				}
-			}
-
-			if (is_good) ++good;
+			if (masks.isFullyColored(masks.neighbors(aset[0], c))) ++good;
 		}
 
 		map[good]++;
@@ -202,56 +196,308 @@ void countGoodNeighborhoods(
 }
 
 
+void printUsage() noexcept
+{
+	std::fprintf(
+		stderr,
+		"Usage:\n"
+		"  main run --from STAGE [--to STAGE] [options]\n"
+		"  main run --stage STAGE [options]\n"
+		"  main augment [--k-start K] [--k-stop K] [--colors C] [--delta] [options]\n"
+		"  main merge --out PATH [--stage STAGE] [options] SHARD...\n"
+		"  main verify [--stage STAGE]\n"
+		"  main regress [--golden FILE] [--record] [--tolerance X]\n"
+		"  main index --in PATH --out INDEX [--stage STAGE]\n"
+		"  main lookup --index INDEX --in PATH\n"
+		"  main stages\n"
+		"\n"
+		"Options:\n"
+		"  --in PATH|-           input graphs (default: stage input file)\n"
+		"  --out PATH|-          output graphs (default: stage output file)\n"
+		"  --in-format adj|mc    input format (default: adj)\n"
+		"  --out-format adj|mc   output format (default: adj)\n"
+		"  --keep DIR            also write intermediate stage outputs to DIR\n"
+		"  --shard I/N           process the I-th of N invariant-hash slices\n"
+		"  --metrics DIR         write per-stage counters as JSON into DIR\n"
+		"  --aut                 write automorphism groups next to graph files (.aut)\n"
+		"  --trace FILE          write a trace-event timeline (chrome://tracing)\n"
+		"  --threads N           worker threads (default: 1, more need nauty built with TLS)\n"
+		"  --external-dedup      deduplicate canonical forms on disk\n"
+		"  --mem-budget MB       key memory before spilling a sorted run\n"
+		"  --scratch DIR         directory for spilled runs\n"
+		"  --delta               store augment levels as parent deltas (.delta)\n"
+		"  --index FILE          canonical index built by the index command\n"
+		"  --golden FILE         golden counts and relative times (default: graphs/golden.txt)\n"
+		"  --record              store this run as the new golden file\n"
+		"  --tolerance X         fail when X times slower than the baseline, measured\n"
+		"                        relative to augment/k8 (default: 1.25)\n"
+	);
+}
+
+
 int main(int argc, char **argv)
 {
-	// auto gs = loadBulkAdj("graphs/60/upsilon3.adj");
-	// std::printf("%d graphs\n", gs.size());
-	// upsilon60_1();
-	// upsilon60_2(loadBulkAdj("graphs/60/upsilon1.adj"));
-	// upsilon60_3(loadBulkAdj("graphs/60/upsilon2.adj"));
-	upsilon60_4(loadBulkAdj("graphs/60/upsilon3.adj"));
-	// upsilon60_5(loadBulkAdj("graphs/60/upsilon4.adj"));
-	// upsilon60_6(loadBulkAdj("graphs/60/upsilon5.adj"));
-
-	// upsilon62_1();
-	// upsilon62_2(loadBulkAdj("graphs/62/upsilon1.adj"));
-	// upsilon62_3(loadBulkAdj("graphs/62/upsilon2.adj"));
-	// upsilon62_4(loadBulkAdj("graphs/62/upsilon3.adj"));
-	// upsilon62_5(loadBulkAdj("graphs/62/upsilon4.adj"));
-
-	// testEmbed();
-	// testNeighborhoods(loadBulkAdj("graphs/62/upsilon3.adj"));
-	// testNeighborhoods(loadBulkAdj("graphs/jacks/table7.adj"));
-	// testPullback();
-	
-
-	// auto my_up = loadBulkAdj("graphs/62/upsilon5.adj");
-	// std::printf("My Graphs: %d\n", my_up.size());
-	//
-	// auto stan_up = loadBulkAdj("graphs/stan/upsilon5.adj");
-	// std::printf("Stan Graphs: %d\n", stan_up.size());
-	//
-	// bool b = isIsomorphicEqual(my_up, stan_up);
-	// std::printf("Result: %b\n", b);
-	//
-	// countGoodNeighborhoods(my_up, 4);
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
 
+	std::string command = argv[1];
+	PipelineOptions options;
+	int k_start = 3;
+	int k_stop = 16;
+	int num_colors = 3;
+	std::filesystem::path trace_path;
+	RegressionOptions regression;
+	bool delta_levels = false;
+	std::filesystem::path index_path;
+	std::vector<std::filesystem::path> positional;
 
+	// Parse flags
+	for (auto i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = (i+1 < argc);
+		std::string value = has_value ? argv[i+1] : "";
 
+		if (arg == "--external-dedup")
+		{
+			options.context.dedup.external = true;
+			continue;
+		}
 
-	// auto t_perms = make_tperms();
-	// for (auto i = 1; i <= 2; ++i)
-	// {
-	// 	for (auto c = 1; c <= 3; ++c)
-	// 	{
-	// 		auto& g = t_perms[i].at(c);
-	// 		std::printf("%s\n", g.to_string().c_str());
-	// 	}
-	// }
-	//
-	// auto t = make_T1();
-	// std::printf("%s\n", t.to_string().c_str());
+		if (arg == "--delta")
+		{
+			delta_levels = true;
+			continue;
+		}
 
-	return 0;
-}
+		if (arg == "--record")
+		{
+			regression.record = true;
+			continue;
+		}
+
+		if (arg == "--aut")
+		{
+			options.write_aut = true;
+			continue;
+		}
+
+		if (arg.rfind("--", 0) != 0)
+		{
+			positional.push_back(arg);
+			continue;
+		}
+
+		if (!has_value)
+		{
+			std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+		++i;
+
+		if (arg == "--from") options.from = value;
+		else if (arg == "--to") options.to = value;
+		else if (arg == "--stage") options.from = options.to = value;
+		else if (arg == "--in") options.input_path = value;
+		else if (arg == "--out") options.output_path = value;
+		else if (arg == "--keep") options.keep_dir = value;
+		else if (arg == "--metrics") options.metrics_dir = value;
+		else if (arg == "--trace") trace_path = value;
+		else if (arg == "--shard")
+		{
+			if (std::sscanf(value.c_str(), "%d/%d", &options.shard_index, &options.shard_count) != 2 ||
+				options.shard_count < 1 ||
+				options.shard_index < 0 ||
+				options.shard_index >= options.shard_count)
+			{
+				std::fprintf(stderr, "Invalid shard %s, expected I/N with 0 <= I < N\n", value.c_str());
+				return 1;
+			}
+		}
+		else if (arg == "--threads") options.context.num_threads = std::atoi(value.c_str());
+		else if (arg == "--mem-budget") options.context.dedup.memory_budget = std::atoll(value.c_str()) << 20;
+		else if (arg == "--scratch") options.context.dedup.scratch_dir = value;
+		else if (arg == "--k-start") k_start = std::atoi(value.c_str());
+		else if (arg == "--k-stop") k_stop = std::atoi(value.c_str());
+		else if (arg == "--colors") num_colors = std::atoi(value.c_str());
+		else if (arg == "--golden") regression.golden_path = value;
+		else if (arg == "--index") index_path = value;
+		else if (arg == "--tolerance") regression.tolerance = std::atof(value.c_str());
+		else if (arg == "--in-format" || arg == "--out-format")
+		{
+			auto format = parseGraphFormat(value);
+			if (!format)
+			{
+				std::fprintf(stderr, "Unknown format %s\n", value.c_str());
+				return 1;
+			}
+
+			if (arg == "--in-format") options.input_format = *format;
+			else options.output_format = *format;
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			printUsage();
+			return 1;
+		}
+	}
 
+	if (options.context.num_threads < 1) options.context.num_threads = 1;
+	if (options.context.num_threads > 1 && !nautyIsThreadSafe())
+	{
+		std::fprintf(
+			stderr,
+			"--threads %d needs nauty built with thread-local storage (./configure --enable-tls)\n",
+			options.context.num_threads
+		);
+		return 1;
+	}
+
+	// Spans are written once the command's workers have been joined
+	Trace::setEnabled(!trace_path.empty());
+	auto finish = [&](int status) {
+		if (!trace_path.empty()) Trace::write(trace_path);
+		return status;
+	};
+
+
+	// Dispatch
+	if (command == "run")
+	{
+		if (options.to.empty()) options.to = options.from;
+		return finish(runPipeline(options) ? 0 : 1);
+	}
+
+	// Merges, indexes and checks canonize like the stage that wrote the graphs
+	CanonSpec canon_spec;
+	if (!options.from.empty())
+	{
+		const auto* stage = findStage(options.from);
+		if (!stage)
+		{
+			std::fprintf(stderr, "Unknown stage %s\n", options.from.c_str());
+			return 1;
+		}
+		canon_spec = stage->canon_spec;
+	}
+
+	if (command == "merge")
+	{
+		MergeOptions merge;
+		merge.input_paths = positional;
+		merge.output_path = options.output_path;
+		merge.input_format = options.input_format;
+		merge.output_format = options.output_format;
+		merge.metrics_dir = options.metrics_dir;
+		merge.canon_spec = canon_spec;
+		merge.context = options.context;
+		return finish(mergeShards(merge) ? 0 : 1);
+	}
+
+	if (command == "augment")
+	{
+		bool has_metrics = !options.metrics_dir.empty();
+		Metrics::setEnabled(has_metrics);
+		auto start_time = std::chrono::high_resolution_clock::now();
+
+		auto levels = augment(
+			k_start,
+			k_stop,
+			static_cast<Color>(num_colors),
+			options.context.dedup,
+			"graphs",
+			delta_levels,
+			options.context.num_threads
+		);
+		if (levels.empty() && k_start <= k_stop) return finish(1);
+
+		auto end_time = std::chrono::high_resolution_clock::now();
+		Timing::seconds time = end_time - start_time;
+		if (has_metrics)
+		{
+			Metrics::writeJson(options.metrics_dir / "augment.json", "augment", {
+				{ "wall_seconds", time.count() },
+				{ "k_start", static_cast<double>(k_start) },
+				{ "k_stop", static_cast<double>(k_stop) },
+				{ "colors", static_cast<double>(num_colors) }
+			}, Metrics::snapshot());
+		}
+		return finish(0);
+	}
+
+	if (command == "verify")
+	{
+		verify(canon_spec);
+		return 0;
+	}
+
+	if (command == "regress")
+	{
+		regression.context = options.context;
+		return finish(runRegression(regression) ? 0 : 1);
+	}
+
+	if (command == "index")
+	{
+		if (options.input_path.empty() || options.output_path.empty())
+		{
+			std::fprintf(stderr, "index needs --in and --out\n");
+			return 1;
+		}
+
+		auto graphs = readGraphs(options.input_path, options.input_format);
+		auto index = CanonIndex::fromGraphs(graphs, canon_spec, options.context.num_threads);
+		std::printf(
+			"Indexed %zu graphs: %zu distinct, %zu bytes\n",
+			graphs.size(),
+			index.size(),
+			index.memoryBytes()
+		);
+		return index.save(options.output_path) ? 0 : 1;
+	}
+
+	if (command == "lookup")
+	{
+		if (index_path.empty() || options.input_path.empty())
+		{
+			std::fprintf(stderr, "lookup needs --index and --in\n");
+			return 1;
+		}
+
+		auto index = CanonIndex::open(index_path);
+		if (!index) return 1;
+
+		auto graphs = readGraphs(options.input_path, options.input_format);
+		std::vector<char> found(graphs.size());
+		TaskScheduler scheduler(options.context.num_threads);
+		parallelFor(scheduler, 0, graphs.size(), [&](size_t i) {
+			found[i] = index->contains(graphs[i]);
+		});
+
+		size_t num_found = std::count(found.begin(), found.end(), 1);
+		std::printf("%zu of %zu graphs are in %s\n", num_found, graphs.size(), index_path.c_str());
+		return num_found == graphs.size() ? 0 : 2;
+	}
+
+	if (command == "stages")
+	{
+		for (const auto& stage : stages())
+		{
+			std::printf(
+				"%s: %s -> %s\n",
+				stage.name.c_str(),
+				stage.default_input.empty() ? "(none)" : stage.default_input.c_str(),
+				stage.default_output.c_str()
+			);
+		}
+		return 0;
+	}
+
+	printUsage();
+	return 1;
+}